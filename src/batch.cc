@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "sim_bp.h"
+#include "trace.h"
+#include "sweep.h"
+#include "batch.h"
+#include "cache.h"
+
+// One (trace, configuration) job of the manifest
+typedef struct batch_job{
+    const char*         trace_file;
+    bp_params           params;
+    uint64_t            trace_size;         // bytes; the estimate of how long the job runs
+    const ResultCache*  cache;              // result cache of the trace, or NULL
+    uint64_t            predictions;
+    uint64_t            mispredictions;
+}batch_job;
+
+// The jobs of one trace that are not cached, run together over a single read of the trace
+typedef struct batch_group{
+    const char*         trace_file;
+    bool                text;               // read through a parser thread
+    std::vector<size_t> jobs;
+    uint64_t            cost;               // trace bytes times jobs; the estimate of how long the group runs
+    size_t              num_threads;        // sweep workers running its jobs in lockstep
+    size_t              num_cores;          // cores it holds while running: its workers and its parser thread
+}batch_group;
+
+// A worker's queue of group indices, costliest first. The owner and thieves both take from the front.
+typedef struct batch_queue{
+    std::mutex          lock;
+    std::deque<size_t>  groups;
+}batch_queue;
+
+// The cores the running groups may keep busy, one per sweep worker and one per text parser thread
+typedef struct batch_cores{
+    std::mutex              lock;
+    std::condition_variable released;
+    size_t                  available;
+}batch_cores;
+
+// Read the whole manifest into text and expand every line into jobs. The trace names and predictor names
+// of the jobs point into text, which must outlive them. With cache_dir, each line's trace is hashed here,
+// once, and its result cache added to caches.
+static void read_manifest(const char* manifest_file, const char* cache_dir, std::vector<char>& text, std::vector<batch_job>& jobs,
+                          std::vector<ResultCache*>& caches){
+    FILE* FP = fopen(manifest_file, "r");
+    if(FP == NULL){
+        printf("Error: Unable to open file %s\n", manifest_file);
+        exit(EXIT_FAILURE);
+    }
+    char buffer[4096];
+    size_t bytes;
+    while((bytes = fread(buffer, 1, sizeof(buffer), FP)) > 0){
+        text.insert(text.end(), buffer, buffer + bytes);
+    }
+    fclose(FP);
+    text.push_back('\0');
+
+    int line_number = 0;
+    for(char* line = &text[0]; line != NULL; ){
+        char* next = strchr(line, '\n');
+        if(next != NULL){
+            *next++ = '\0';
+        }
+        line_number++;
+
+        // Split the line first: expand_sweep_spec tokenizes each spec with strtok
+        std::vector<char*> fields;
+        char* save;
+        for(char* p = strtok_r(line, " \t\r", &save); p != NULL && p[0] != '#'; p = strtok_r(NULL, " \t\r", &save)){
+            fields.push_back(p);
+        }
+        line = next;
+        if(fields.empty()){
+            continue;
+        }
+        if(fields.size() < 2){
+            printf("Error: Manifest %s line %d has no predictor specs\n", manifest_file, line_number);
+            exit(EXIT_FAILURE);
+        }
+
+        struct stat info;
+        if(stat(fields[0], &info) != 0){
+            printf("Error: Unable to open file %s\n", fields[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        std::vector<bp_params> configs;
+        for(size_t i = 1; i < fields.size(); i++){
+            expand_sweep_spec(fields[i], configs);
+        }
+        ResultCache* cache = NULL;
+        if(cache_dir != NULL){
+            cache = new ResultCache(cache_dir, fields[0]);
+            caches.push_back(cache);
+        }
+        for(size_t i = 0; i < configs.size(); i++){
+            batch_job job;
+            job.trace_file = fields[0];
+            job.params = configs[i];
+            job.trace_size = (uint64_t)info.st_size;
+            job.cache = cache;
+            job.predictions = 0;
+            job.mispredictions = 0;
+            jobs.push_back(job);
+        }
+    }
+}
+
+// Whether trace_file starts with the binary trace magic; anything else is read as text
+static bool is_binary_trace(const char* trace_file){
+    char magic[sizeof(((bp_trace_header*)0)->magic)];
+    FILE* FP = fopen(trace_file, "rb");
+    bool binary = FP != NULL && fread(magic, 1, sizeof(magic), FP) == sizeof(magic) &&
+                  memcmp(magic, BP_TRACE_MAGIC, sizeof(BP_TRACE_MAGIC)) == 0;
+    if(FP != NULL){
+        fclose(FP);
+    }
+    return binary;
+}
+
+// Simulate the jobs of a group over one read of its trace, the way a sweep does
+static void run_group(const batch_group& group, std::vector<batch_job>& jobs){
+    std::vector<BranchHistoryTable*> predictors;
+    for(size_t i = 0; i < group.jobs.size(); i++){
+        predictors.push_back(new BranchHistoryTable(jobs[group.jobs[i]].params));
+    }
+
+    TraceReader trace;
+    if(!trace.open(group.trace_file)){
+        printf("Error: Unable to open file %s\n", group.trace_file);
+        exit(EXIT_FAILURE);
+    }
+    run_sweep_predictors(trace, predictors, UINT64_MAX, group.num_threads);
+
+    for(size_t i = 0; i < group.jobs.size(); i++){
+        batch_job& job = jobs[group.jobs[i]];
+        job.predictions = predictors[i]->number_of_predictions;
+        job.mispredictions = predictors[i]->number_of_mispredictions;
+        if(job.cache != NULL){
+            job.cache->store(job.params, job.predictions, job.mispredictions);
+        }
+        delete predictors[i];
+    }
+}
+
+// Take the next group for worker t: the front of its own queue, or else the costliest group at the front of
+// any other queue. Returns false once every queue is empty (no groups are ever added, so that is final).
+static bool next_group(std::vector<batch_queue>& queues, const std::vector<batch_group>& groups, size_t t, size_t* group){
+    {
+        std::lock_guard<std::mutex> guard(queues[t].lock);
+        if(!queues[t].groups.empty()){
+            *group = queues[t].groups.front();
+            queues[t].groups.pop_front();
+            return true;
+        }
+    }
+
+    while(true){
+        // Step 1: Find the victim whose next group is the costliest
+        size_t victim = queues.size();
+        uint64_t largest = 0;
+        for(size_t v = 0; v < queues.size(); v++){
+            std::lock_guard<std::mutex> guard(queues[v].lock);
+            if(!queues[v].groups.empty() && (victim == queues.size() || groups[queues[v].groups.front()].cost > largest)){
+                victim = v;
+                largest = groups[queues[v].groups.front()].cost;
+            }
+        }
+        if(victim == queues.size()){
+            return false;
+        }
+
+        // Step 2: Steal it, unless the victim's queue emptied in the meantime
+        std::lock_guard<std::mutex> guard(queues[victim].lock);
+        if(!queues[victim].groups.empty()){
+            *group = queues[victim].groups.front();
+            queues[victim].groups.pop_front();
+            return true;
+        }
+    }
+}
+
+int run_batch_manifest(const char* manifest_file, const char* csv_file, const char* cache_dir, int* num_groups,
+                       int* num_concurrent){
+    std::vector<char> text;
+    std::vector<batch_job> jobs;
+    std::vector<ResultCache*> caches;
+    read_manifest(manifest_file, cache_dir, text, jobs, caches);
+    if(jobs.empty()){
+        printf("Error: Manifest %s has no jobs\n", manifest_file);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE* csv = fopen(csv_file, "w");
+    if(csv == NULL){
+        printf("Error: Unable to open file %s\n", csv_file);
+        exit(EXIT_FAILURE);
+    }
+
+    // Step 1: Answer the cached jobs, and group the others by trace so each trace is read once
+    std::vector<batch_group> groups;
+    std::map<std::string, size_t> group_of_trace;
+    for(size_t i = 0; i < jobs.size(); i++){
+        batch_job& job = jobs[i];
+        if(job.cache != NULL && job.cache->lookup(job.params, &job.predictions, &job.mispredictions)){
+            continue;
+        }
+        std::map<std::string, size_t>::iterator known = group_of_trace.find(job.trace_file);
+        if(known == group_of_trace.end()){
+            batch_group group;
+            group.trace_file = job.trace_file;
+            group.text = !is_binary_trace(job.trace_file);
+            group.cost = 0;
+            group.num_threads = 1;
+            group.num_cores = 1;
+            known = group_of_trace.insert(std::make_pair(std::string(job.trace_file), groups.size())).first;
+            groups.push_back(group);
+        }
+        batch_group& group = groups[known->second];
+        group.jobs.push_back(i);
+        group.cost += job.trace_size;
+    }
+
+    // Step 2: Split the cores evenly between the groups that can run at once. The share of a text group
+    // includes its parser thread, so its jobs get one core less (but always at least one thread).
+    size_t num_cores = std::thread::hardware_concurrency();
+    if(num_cores == 0){
+        num_cores = 1;
+    }
+    size_t num_workers = std::min(num_cores, groups.size());
+    size_t share = std::max<size_t>(1, num_cores / std::max<size_t>(1, num_workers));
+    for(size_t g = 0; g < groups.size(); g++){
+        size_t parser = groups[g].text ? 1 : 0;
+        groups[g].num_threads = std::max<size_t>(1, std::min(groups[g].jobs.size(), share - std::min(share, parser)));
+        groups[g].num_cores = std::min(share, groups[g].num_threads + parser);
+    }
+
+    if(num_groups != NULL){
+        *num_groups = (int)groups.size();
+    }
+
+    // Step 3: Deal the groups, costliest first, round-robin onto the worker queues, and run them
+    std::vector<size_t> order(groups.size());
+    for(size_t i = 0; i < order.size(); i++){
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b){
+        return groups[a].cost > groups[b].cost;
+    });
+    std::vector<batch_queue> queues(num_workers);
+    for(size_t i = 0; i < order.size(); i++){
+        queues[i % num_workers].groups.push_back(order[i]);
+    }
+
+    // The first group of every queue starts right away as long as their shares fit in the cores together
+    size_t in_use = 0;
+    size_t concurrent = 0;
+    while(concurrent < num_workers && in_use + groups[order[concurrent]].num_cores <= num_cores){
+        in_use += groups[order[concurrent++]].num_cores;
+    }
+    if(num_concurrent != NULL){
+        *num_concurrent = (int)concurrent;
+    }
+
+    batch_cores cores;
+    cores.available = num_cores;
+    std::vector<std::thread> workers;
+    for(size_t t = 0; t < num_workers; t++){
+        workers.push_back(std::thread([&, t](){
+            size_t g;
+            while(next_group(queues, groups, t, &g)){
+                size_t needed = groups[g].num_cores;
+                {
+                    std::unique_lock<std::mutex> guard(cores.lock);
+                    cores.released.wait(guard, [&](){ return cores.available >= needed; });
+                    cores.available -= needed;
+                }
+                run_group(groups[g], jobs);
+                {
+                    std::lock_guard<std::mutex> guard(cores.lock);
+                    cores.available += needed;
+                }
+                cores.released.notify_all();
+            }
+        }));
+    }
+    for(size_t t = 0; t < workers.size(); t++){
+        workers[t].join();
+    }
+
+    // Write the results in manifest order
+    fprintf(csv, SWEEP_CSV_HEADER);
+    for(size_t i = 0; i < jobs.size(); i++){
+        write_sweep_row(csv, jobs[i].trace_file, jobs[i].params, jobs[i].predictions, jobs[i].mispredictions);
+    }
+    for(size_t i = 0; i < caches.size(); i++){
+        delete caches[i];
+    }
+
+    if(fclose(csv) != 0){
+        printf("Error: Unable to write file %s\n", csv_file);
+        exit(EXIT_FAILURE);
+    }
+    return (int)jobs.size();
+}
@@ -0,0 +1,33 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+/*  Multi-trace batch runner ("sim batch")
+
+    Runs every job listed in manifest_file and writes one CSV row per job to csv_file, in manifest order,
+    with the same columns as a sweep (see sweep.h). Each manifest line names a trace followed by one or more
+    sweep specs; every configuration a spec expands to is one job:
+
+        # trace                 specs
+        ../tests/gcc_trace.txt  bimodal:7-20 gshare:7-20:0-20
+        ../tests/jpeg_trace.bpt hybrid:8:14:10:5 tage:7:10:200:12
+
+    Blank lines and lines starting with '#' are ignored. With cache_dir, jobs found in the result cache (see
+    cache.h) are answered from it, and the results of the others are added to it.
+
+    The jobs still to run are grouped by trace, and each group is simulated like a sweep: one read of the
+    trace drives all of its predictors in lockstep, so a text trace is parsed once however many jobs it
+    has. Groups run on a work-stealing pool of up to one worker per core: they are sorted by cost (trace
+    size times jobs), costliest first, and dealt round-robin onto per-worker queues. A worker runs its own
+    queue front to back, and once it is empty steals the costliest group still queued anywhere. The cores
+    are split evenly between the groups that can run at once, and a group only starts once its share is
+    free. The share of a text trace includes its parser thread, so its jobs run on one core less; the
+    running groups never keep more threads busy than there are cores, and every worker's first group can
+    start right away.
+
+    Returns the number of jobs run. num_groups, if not NULL, is set to the number of traces simulated (those
+    with jobs not in the cache), and num_concurrent to how many of them the core split lets run at once.
+*/
+int run_batch_manifest(const char* manifest_file, const char* csv_file, const char* cache_dir, int* num_groups = NULL,
+                       int* num_concurrent = NULL);
+
+#endif
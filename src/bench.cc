@@ -0,0 +1,678 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include "sim_bp.h"
+#include "trace.h"
+#include "sweep.h"
+
+/*  Simulator throughput benchmark
+
+    bench [--sizes N,N,...] [--patterns P,P,...] [--json] [spec ...]
+    times every predictor configuration (sweep specs, see sweep.h; a default grid if none are given) on
+    every synthetic trace pattern and size, and prints one CSV row (or JSON object) per run with the
+    throughput, time per branch and peak resident set size. Each run is done in its own child process so
+    the peak RSS belongs to that configuration alone. Only the predictor loop is timed; the trace is
+    generated in batches outside the timed region.
+
+    bench gen PATTERN BRANCHES FILE
+    writes a synthetic trace to FILE, as text if FILE ends in .txt and in the binary format otherwise.
+
+    bench verify [BRANCHES [DIR]]
+    64-bit regression test ("make verify"): runs BRANCHES (default 4500000000, past 2^32) synthetic
+    branches with full 64-bit PCs through the sim binary next to bench, as binary traces written to DIR
+    (default the current directory; about 40GB free at the default size) and as text on its standard
+    input, and fails unless every count it prints, writes to a sweep CSV or saves in a snapshot matches
+    the expected one. See verify().
+
+    Patterns (all deterministic):
+      loop      loop-closing branches with fixed trip counts (taken trip-1 times, then not-taken)
+      random    a few thousand static branches with random, unbiased outcomes
+      aliased   groups of 256 strongly biased static branches whose PCs only differ above bit 25, so each
+                group collides in every table indexed by up to 24 PC bits
+*/
+
+#define BENCH_BATCH_SIZE    (1 << 16)
+
+static char default_grid[][24] = {
+    "bimodal:10", "bimodal:16", "bimodal:22",
+    "gshare:10:4", "gshare:16:8", "gshare:22:12",
+    "hybrid:8:12:6:10", "hybrid:12:18:10:16", "hybrid:16:22:14:20"
+};
+
+// Deterministic synthetic branch stream
+class SyntheticTrace{
+public:
+    SyntheticTrace(const char* pattern) : pattern(pattern), state(0x9e3779b97f4a7c15ULL), current(0), remaining(0) {
+        if(strcmp(pattern, "loop") == 0){
+            num_static = 256;
+        } else if(strcmp(pattern, "random") == 0){
+            num_static = 4096;
+        } else if(strcmp(pattern, "aliased") == 0){
+            num_static = 1 << 16;
+        } else {
+            printf("Error: Unknown trace pattern %s\n", pattern);
+            exit(EXIT_FAILURE);
+        }
+        // Per static branch: loop trip count, or bias towards taken
+        for(unsigned int i = 0; i < num_static; i++){
+            behavior.push_back((unsigned int)(random() % 63) + 2);
+        }
+    }
+
+    void next(uint64_t* addr, char* outcome, size_t count){
+        if(pattern[0] == 'l'){
+            // Run each loop to completion, then move on to the next one
+            for(size_t i = 0; i < count; i++){
+                if(remaining == 0){
+                    current = (unsigned int)(random() % num_static);
+                    remaining = behavior[current];
+                }
+                remaining--;
+                addr[i] = 0x400000UL + 64 * current;
+                outcome[i] = remaining ? 't' : 'n';
+            }
+        } else if(pattern[0] == 'r'){
+            for(size_t i = 0; i < count; i++){
+                uint64_t r = random();
+                addr[i] = 0x400000UL + 4 * (r % num_static);
+                outcome[i] = ((r >> 32) & 1) ? 't' : 'n';
+            }
+        } else {
+            // Static branch k shares PC bits 0-25 with 255 others; it goes its biased way (odd behavior
+            // taken, even not-taken) 90% of the time
+            for(size_t i = 0; i < count; i++){
+                uint64_t r = random();
+                unsigned int k = (unsigned int)(r % num_static);
+                bool bias = behavior[k] & 1;
+                bool flip = ((r >> 32) % 10) == 0;
+                addr[i] = 0x400000UL + 4 * (k % 256) + ((uint64_t)(k / 256) << 26);
+                outcome[i] = (bias != flip) ? 't' : 'n';
+            }
+        }
+    }
+
+private:
+    // xorshift64*
+    uint64_t random(){
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545f4914f6cdd1dULL;
+    }
+
+    const char*                 pattern;
+    uint64_t                    state;
+    unsigned int                num_static;
+    std::vector<unsigned int>   behavior;
+    unsigned int                current;
+    unsigned int                remaining;
+};
+
+/*  The verify stream: loop branches run to completion one after another, at PCs that differ only above
+    bit 32 in groups of four (above bit 25 with pc_bytes 4, so the PCs still fit). A 2-bit counter is back
+    at weakly taken after every complete loop, whatever other loops share it, so bimodal, history-less
+    gshare and a hybrid of the two mispredict exactly once per loop: on its not-taken exit.
+*/
+class VerifyTrace{
+public:
+    VerifyTrace(uint32_t pc_bytes) : loop_exits(0), shift((pc_bytes == 8) ? 33 : 26), current(0), remaining(2) {}
+
+    void next(uint64_t* addr, char* outcome, size_t count){
+        for(size_t i = 0; i < count; i++){
+            addr[i] = 0x400000ULL + 4 * (current % 64) + ((uint64_t)(current / 64) << shift);
+            outcome[i] = --remaining ? 't' : 'n';
+            if(remaining == 0){
+                loop_exits++;
+                current = (current + 1) % 256;
+                remaining = 2 + current % 61;
+            }
+        }
+    }
+
+    uint64_t        loop_exits;     // not-taken loop exits generated so far
+
+private:
+    int             shift;
+    unsigned int    current;
+    unsigned int    remaining;
+};
+
+typedef struct verify_predictor{
+    const char*     spec;           // sweep spec
+    const char*     args;           // the same predictor on sim's command line
+    bool            exact;          // mispredicts only on loop exits; the others are checked against the
+                                    // same predictor run in-process
+}verify_predictor;
+
+static const verify_predictor verify_predictors[] = {
+    { "bimodal:10",         "bimodal 10",           true },
+    { "gshare:12:0",        "gshare 12 0",          true },
+    { "hybrid:10:12:0:10",  "hybrid 10 12 0 10",    true },
+    { "gshare:14:10",       "gshare 14 10",         false },
+    { "hybrid:8:14:10:12",  "hybrid 8 14 10 12",    false }
+};
+#define VERIFY_NUM_PREDICTORS   5
+#define VERIFY_SINGLE_RUN       3       // the one also run on its own, with a snapshot, and on the text trace
+
+static bool check_counts(const std::string& what, uint64_t predictions, uint64_t mispredictions,
+                         uint64_t expected_predictions, uint64_t expected_mispredictions){
+    bool match = predictions == expected_predictions && mispredictions == expected_mispredictions;
+    printf("%s: %llu predictions, %llu mispredictions (expected %llu, %llu) %s\n", what.c_str(),
+           (unsigned long long)predictions, (unsigned long long)mispredictions,
+           (unsigned long long)expected_predictions, (unsigned long long)expected_mispredictions, match ? "OK" : "FAILED");
+    fflush(stdout);
+    return match;
+}
+
+static void run_sim(const std::string& command){
+    printf("%s\n", command.c_str());
+    fflush(stdout);
+    if(system(command.c_str()) != 0){
+        printf("Error: %s failed\n", command.c_str());
+        exit(EXIT_FAILURE);
+    }
+}
+
+// The counters sim printed in its OUTPUT section
+static void read_output_counts(const std::string& output_file, uint64_t* predictions, uint64_t* mispredictions){
+    FILE* FP = fopen(output_file.c_str(), "r");
+    if(FP == NULL){
+        printf("Error: Unable to open file %s\n", output_file.c_str());
+        exit(EXIT_FAILURE);
+    }
+    char line[256];
+    unsigned long long value;
+    *predictions = *mispredictions = 0;
+    while(fgets(line, sizeof(line), FP) != NULL){
+        if(sscanf(line, "number of predictions: %llu", &value) == 1){
+            *predictions = value;
+        } else if(sscanf(line, "number of mispredictions: %llu", &value) == 1){
+            *mispredictions = value;
+        }
+    }
+    fclose(FP);
+}
+
+// The counters of the rows of a sweep CSV, in spec order; rows ends in
+// num_predictions,num_mispredictions,misprediction_rate
+static void read_sweep_counts(const std::string& csv_file, size_t count, uint64_t* predictions, uint64_t* mispredictions){
+    FILE* FP = fopen(csv_file.c_str(), "r");
+    if(FP == NULL){
+        printf("Error: Unable to open file %s\n", csv_file.c_str());
+        exit(EXIT_FAILURE);
+    }
+    char line[1024];
+    for(size_t row = 0; row < count; row++){
+        predictions[row] = mispredictions[row] = 0;
+    }
+    for(size_t row = 0; fgets(line, sizeof(line), FP) != NULL && row <= count; row++){
+        int commas = 0;
+        char* p = line + strlen(line);
+        while(p > line && commas < 3){
+            commas += (*--p == ',');
+        }
+        unsigned long long num_predictions, num_mispredictions;
+        if(row > 0 && sscanf(p, ",%llu,%llu", &num_predictions, &num_mispredictions) == 2){
+            predictions[row - 1] = num_predictions;
+            mispredictions[row - 1] = num_mispredictions;
+        }
+    }
+    fclose(FP);
+}
+
+// The counters stored in a snapshot
+static void read_snapshot_counts(const std::string& snapshot_file, uint64_t* predictions, uint64_t* mispredictions){
+    bp_snapshot_header header;
+    FILE* FP = fopen(snapshot_file.c_str(), "rb");
+    if(FP == NULL || fread(&header, sizeof(header), 1, FP) != 1){
+        printf("Error: Unable to read file %s\n", snapshot_file.c_str());
+        exit(EXIT_FAILURE);
+    }
+    fclose(FP);
+    *predictions = header.number_of_predictions;
+    *mispredictions = header.number_of_mispredictions;
+}
+
+// Write branches of the verify stream to FP as text; returns its number of loop exits
+static uint64_t write_text_trace(FILE* FP, uint64_t branches){
+    static const char digits[] = "0123456789abcdef";
+    VerifyTrace trace(8);
+    std::vector<uint64_t> addr(BENCH_BATCH_SIZE);
+    std::vector<char> outcome(BENCH_BATCH_SIZE);
+    std::vector<char> text(BENCH_BATCH_SIZE * 20);
+    for(uint64_t done = 0; done < branches; ){
+        size_t n = (branches - done < BENCH_BATCH_SIZE) ? (size_t)(branches - done) : BENCH_BATCH_SIZE;
+        trace.next(&addr[0], &outcome[0], n);
+        char* p = &text[0];
+        for(size_t i = 0; i < n; i++){
+            char hex[16];
+            int length = 0;
+            uint64_t a = addr[i];
+            do{
+                hex[length++] = digits[a & 15];
+                a >>= 4;
+            }while(a != 0);
+            while(length > 0){
+                *p++ = hex[--length];
+            }
+            *p++ = ' ';
+            *p++ = outcome[i];
+            *p++ = '\n';
+        }
+        fwrite(&text[0], 1, p - &text[0], FP);
+        done += n;
+    }
+    return trace.loop_exits;
+}
+
+/*  Checks sim batch over a manifest of several text traces: the counts of every job, and that the cores are
+    split so that all of the traces (up to one per core) run at once, parser threads included.
+
+    sim is the simulator binary. The traces, manifest and CSV go to dir and are removed afterwards.
+*/
+#define VERIFY_BATCH_TRACES     3
+#define VERIFY_BATCH_BRANCHES   1000000     // branches of the first trace; the others are 2 and 3 times longer
+
+static bool verify_batch(const std::string& dir, const std::string& sim){
+    static const char* specs[] = { "bimodal:10", "gshare:12:0" };      // both exact
+    std::string manifest_file = dir + "/verify_batch.manifest";
+    std::string csv_file = dir + "/verify_batch.csv";
+    std::string output_file = dir + "/verify_batch.out";
+
+    // Step 1: Write the traces and the manifest
+    std::string trace_files[VERIFY_BATCH_TRACES];
+    uint64_t branches[VERIFY_BATCH_TRACES], loop_exits[VERIFY_BATCH_TRACES];
+    FILE* manifest = fopen(manifest_file.c_str(), "w");
+    if(manifest == NULL){
+        printf("Error: Unable to open file %s\n", manifest_file.c_str());
+        exit(EXIT_FAILURE);
+    }
+    for(int t = 0; t < VERIFY_BATCH_TRACES; t++){
+        trace_files[t] = dir + "/verify_batch" + std::to_string(t) + ".txt";
+        branches[t] = VERIFY_BATCH_BRANCHES * (uint64_t)(t + 1);
+        FILE* FP = fopen(trace_files[t].c_str(), "w");
+        if(FP == NULL){
+            printf("Error: Unable to open file %s\n", trace_files[t].c_str());
+            exit(EXIT_FAILURE);
+        }
+        loop_exits[t] = write_text_trace(FP, branches[t]);
+        fclose(FP);
+        fprintf(manifest, "%s %s %s\n", trace_files[t].c_str(), specs[0], specs[1]);
+    }
+    fclose(manifest);
+
+    // Step 2: Run them and check every job, in manifest order
+    run_sim(sim + " batch " + manifest_file + " " + csv_file + " > " + output_file);
+    bool ok = true;
+    uint64_t predictions[VERIFY_BATCH_TRACES * 2], mispredictions[VERIFY_BATCH_TRACES * 2];
+    read_sweep_counts(csv_file, VERIFY_BATCH_TRACES * 2, predictions, mispredictions);
+    for(int t = 0; t < VERIFY_BATCH_TRACES; t++){
+        for(int s = 0; s < 2; s++){
+            ok = check_counts(std::string("batch, text, ") + trace_files[t] + " " + specs[s], predictions[2 * t + s],
+                              mispredictions[2 * t + s], branches[t], loop_exits[t]) && ok;
+        }
+    }
+
+    // Step 3: Check that the core split let every trace start at once
+    int concurrent = -1;
+    char line[1024];
+    FILE* FP = fopen(output_file.c_str(), "r");
+    while(FP != NULL && fgets(line, sizeof(line), FP) != NULL){
+        sscanf(line, "ran %*d jobs (%*d traces simulated, %d at once)", &concurrent);
+    }
+    if(FP != NULL){
+        fclose(FP);
+    }
+    unsigned int num_cores = std::thread::hardware_concurrency();
+    int expected = (int)std::min<unsigned int>(VERIFY_BATCH_TRACES, std::max(1u, num_cores));
+    bool match = concurrent == expected;
+    printf("batch, text: %d traces at once (expected %d on %u cores) %s\n", concurrent, expected, num_cores,
+           match ? "OK" : "FAILED");
+    fflush(stdout);
+    ok = match && ok;
+
+    for(int t = 0; t < VERIFY_BATCH_TRACES; t++){
+        remove(trace_files[t].c_str());
+    }
+    remove(manifest_file.c_str());
+    remove(csv_file.c_str());
+    remove(output_file.c_str());
+    return ok;
+}
+
+/*  Checks every path a PC or a count takes from the trace to the output, past 2^32 branches:
+
+    1. the stream is written as a binary trace with 8 byte PCs, and run in-process through the kernels of
+       every verify_predictors entry for the expected counts
+    2. sim sweep over that trace: the mmap reader (PC array and outcome bitmap) and the CSV counters
+    3. sim on its own with --save-snapshot: the trace loop, print_contents and the snapshot counters
+    4. the same stream as text on sim's standard input: the text parser
+    5. sim sweep over the stream written with 4 byte PCs, for the exact predictors
+
+    sim is the simulator binary. The trace files go to dir and each is removed once it has been used.
+*/
+static int verify(uint64_t branches, const std::string& dir, const std::string& sim){
+    std::string trace_file = dir + "/verify.bpt";
+    std::string csv_file = dir + "/verify.csv";
+    std::string output_file = dir + "/verify.out";
+    std::string snapshot_file = dir + "/verify.snap";
+    const verify_predictor& single = verify_predictors[VERIFY_SINGLE_RUN];
+
+    // Step 1: Write the trace and run the predictors in-process over the same stream
+    std::vector<char> spec_text[VERIFY_NUM_PREDICTORS];
+    std::vector<BranchHistoryTable*> predictors;
+    for(int i = 0; i < VERIFY_NUM_PREDICTORS; i++){
+        std::vector<bp_params> configs;
+        const char* spec = verify_predictors[i].spec;
+        spec_text[i].assign(spec, spec + strlen(spec) + 1);
+        expand_sweep_spec(&spec_text[i][0], configs);
+        predictors.push_back(new BranchHistoryTable(configs[0]));
+    }
+
+    std::vector<uint64_t> addr(BENCH_BATCH_SIZE);
+    std::vector<char> outcome(BENCH_BATCH_SIZE);
+    VerifyTrace trace(8);
+    TraceWriter writer;
+    writer.open(trace_file.c_str(), 8);
+    for(uint64_t done = 0; done < branches; ){
+        size_t n = (branches - done < BENCH_BATCH_SIZE) ? (size_t)(branches - done) : BENCH_BATCH_SIZE;
+        trace.next(&addr[0], &outcome[0], n);
+        for(size_t i = 0; i < n; i++){
+            writer.write(addr[i], outcome[i] == 't');
+        }
+        for(size_t p = 0; p < predictors.size(); p++){
+            predictors[p]->with_kernel([&](auto& kernel){
+                for(size_t i = 0; i < n; i++){
+                    kernel.step(addr[i], outcome[i] == 't');
+                }
+            });
+        }
+        done += n;
+    }
+    writer.close();
+
+    bool ok = true;
+    uint64_t expected_predictions[VERIFY_NUM_PREDICTORS], expected_mispredictions[VERIFY_NUM_PREDICTORS];
+    for(int p = 0; p < VERIFY_NUM_PREDICTORS; p++){
+        expected_predictions[p] = predictors[p]->number_of_predictions;
+        expected_mispredictions[p] = predictors[p]->number_of_mispredictions;
+        if(verify_predictors[p].exact){
+            ok = check_counts(std::string("in-process ") + verify_predictors[p].spec, expected_predictions[p],
+                              expected_mispredictions[p], branches, trace.loop_exits) && ok;
+        }
+        delete predictors[p];
+    }
+
+    // Step 2: sim sweep over the binary trace
+    std::string specs;
+    for(int p = 0; p < VERIFY_NUM_PREDICTORS; p++){
+        specs += std::string(" ") + verify_predictors[p].spec;
+    }
+    uint64_t predictions[VERIFY_NUM_PREDICTORS], mispredictions[VERIFY_NUM_PREDICTORS];
+    run_sim(sim + " sweep " + trace_file + " " + csv_file + specs + " > " + output_file);
+    read_sweep_counts(csv_file, VERIFY_NUM_PREDICTORS, predictions, mispredictions);
+    for(int p = 0; p < VERIFY_NUM_PREDICTORS; p++){
+        ok = check_counts(std::string("sweep, 8 byte PCs, ") + verify_predictors[p].spec, predictions[p], mispredictions[p],
+                          expected_predictions[p], expected_mispredictions[p]) && ok;
+    }
+
+    // Step 3: sim on its own, printing the counters and saving them in a snapshot
+    run_sim(sim + " " + single.args + " " + trace_file + " --save-snapshot " + snapshot_file + " > " + output_file);
+    read_output_counts(output_file, &predictions[0], &mispredictions[0]);
+    ok = check_counts(std::string("output, 8 byte PCs, ") + single.spec, predictions[0], mispredictions[0],
+                      expected_predictions[VERIFY_SINGLE_RUN], expected_mispredictions[VERIFY_SINGLE_RUN]) && ok;
+    read_snapshot_counts(snapshot_file, &predictions[0], &mispredictions[0]);
+    ok = check_counts(std::string("snapshot, 8 byte PCs, ") + single.spec, predictions[0], mispredictions[0],
+                      expected_predictions[VERIFY_SINGLE_RUN], expected_mispredictions[VERIFY_SINGLE_RUN]) && ok;
+    remove(trace_file.c_str());
+    remove(snapshot_file.c_str());
+
+    // Step 4: The same stream as text through sim's standard input
+    std::string command = sim + " " + single.args + " - > " + output_file;
+    printf("%s\n", command.c_str());
+    fflush(stdout);
+    FILE* FP = popen(command.c_str(), "w");
+    if(FP == NULL){
+        printf("Error: %s failed\n", command.c_str());
+        exit(EXIT_FAILURE);
+    }
+    write_text_trace(FP, branches);
+    if(pclose(FP) != 0){
+        printf("Error: %s failed\n", command.c_str());
+        exit(EXIT_FAILURE);
+    }
+    read_output_counts(output_file, &predictions[0], &mispredictions[0]);
+    ok = check_counts(std::string("output, text, ") + single.spec, predictions[0], mispredictions[0],
+                      expected_predictions[VERIFY_SINGLE_RUN], expected_mispredictions[VERIFY_SINGLE_RUN]) && ok;
+
+    // Step 5: The stream with 4 byte PCs through sim sweep, for the exact predictors
+    VerifyTrace narrow(4);
+    writer.open(trace_file.c_str(), 4);
+    for(uint64_t done = 0; done < branches; ){
+        size_t n = (branches - done < BENCH_BATCH_SIZE) ? (size_t)(branches - done) : BENCH_BATCH_SIZE;
+        narrow.next(&addr[0], &outcome[0], n);
+        for(size_t i = 0; i < n; i++){
+            writer.write(addr[i], outcome[i] == 't');
+        }
+        done += n;
+    }
+    writer.close();
+
+    specs.clear();
+    int num_exact = 0;
+    for(int p = 0; p < VERIFY_NUM_PREDICTORS; p++){
+        if(verify_predictors[p].exact){
+            specs += std::string(" ") + verify_predictors[p].spec;
+            num_exact++;
+        }
+    }
+    run_sim(sim + " sweep " + trace_file + " " + csv_file + specs + " > " + output_file);
+    read_sweep_counts(csv_file, num_exact, predictions, mispredictions);
+    for(int p = 0, row = 0; p < VERIFY_NUM_PREDICTORS; p++){
+        if(verify_predictors[p].exact){
+            ok = check_counts(std::string("sweep, 4 byte PCs, ") + verify_predictors[p].spec, predictions[row], mispredictions[row],
+                              branches, narrow.loop_exits) && ok;
+            row++;
+        }
+    }
+    remove(trace_file.c_str());
+    remove(csv_file.c_str());
+    remove(output_file.c_str());
+
+    if(!ok){
+        printf("Error: verify failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+// Split a comma separated list in place
+static std::vector<char*> split_list(char* list){
+    std::vector<char*> items;
+    for(char* p = strtok(list, ","); p != NULL; p = strtok(NULL, ",")){
+        items.push_back(p);
+    }
+    return items;
+}
+
+static int generate_trace(const char* pattern, uint64_t branches, const char* trace_file){
+    SyntheticTrace trace(pattern);
+    std::vector<uint64_t> addr(BENCH_BATCH_SIZE);
+    std::vector<char> outcome(BENCH_BATCH_SIZE);
+
+    size_t length = strlen(trace_file);
+    bool text = length > 4 && strcmp(trace_file + length - 4, ".txt") == 0;
+    FILE* FP = NULL;
+    TraceWriter writer;
+    if(text){
+        FP = fopen(trace_file, "w");
+        if(FP == NULL){
+            printf("Error: Unable to open file %s\n", trace_file);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        writer.open(trace_file, 8);
+    }
+
+    for(uint64_t done = 0; done < branches; ){
+        size_t n = (branches - done < BENCH_BATCH_SIZE) ? (size_t)(branches - done) : BENCH_BATCH_SIZE;
+        trace.next(&addr[0], &outcome[0], n);
+        for(size_t i = 0; i < n; i++){
+            if(text){
+                fprintf(FP, "%llx %c\n", (unsigned long long)addr[i], outcome[i]);
+            } else {
+                writer.write(addr[i], outcome[i] == 't');
+            }
+        }
+        done += n;
+    }
+
+    if(text && fclose(FP) != 0){
+        printf("Error: Unable to write file %s\n", trace_file);
+        exit(EXIT_FAILURE);
+    } else if(!text){
+        writer.close();
+    }
+    return 0;
+}
+
+// Time one configuration on one pattern and size, and print its result row
+static void run_benchmark(const char* pattern, uint64_t branches, const bp_params& params, bool json){
+    SyntheticTrace trace(pattern);
+    BranchHistoryTable BHT(params);
+    std::vector<uint64_t> addr(BENCH_BATCH_SIZE);
+    std::vector<char> outcome(BENCH_BATCH_SIZE);
+    std::chrono::steady_clock::duration elapsed(0);
+
+    for(uint64_t done = 0; done < branches; ){
+        size_t n = (branches - done < BENCH_BATCH_SIZE) ? (size_t)(branches - done) : BENCH_BATCH_SIZE;
+        trace.next(&addr[0], &outcome[0], n);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        BHT.with_kernel([&](auto& kernel){
+            for(size_t i = 0; i < n; i++){
+                kernel.step(addr[i], outcome[i] == 't');
+            }
+        });
+        elapsed += std::chrono::steady_clock::now() - start;
+        done += n;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    double misprediction_rate = BHT.number_of_predictions ? (double)BHT.number_of_mispredictions / BHT.number_of_predictions * 100 : 0;
+
+    if(json){
+        printf("{\"pattern\": \"%s\", \"branches\": %llu, \"predictor\": \"%s\", \"K\": %lu, \"M1\": %lu, \"N\": %lu, \"M2\": %lu, "
+               "\"seconds\": %.6f, \"branches_per_sec\": %.0f, \"ns_per_branch\": %.3f, \"peak_rss_kb\": %ld, \"misprediction_rate\": %.2f}\n",
+               pattern, (unsigned long long)branches, params.bp_name, params.K, params.M1, params.N, params.M2,
+               seconds, branches / seconds, seconds * 1e9 / branches, usage.ru_maxrss, misprediction_rate);
+    } else {
+        printf("%s,%llu,%s,%lu,%lu,%lu,%lu,%.6f,%.0f,%.3f,%ld,%.2f\n",
+               pattern, (unsigned long long)branches, params.bp_name, params.K, params.M1, params.N, params.M2,
+               seconds, branches / seconds, seconds * 1e9 / branches, usage.ru_maxrss, misprediction_rate);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[]){
+    if(argc > 1 && strcmp(argv[1], "gen") == 0){
+        if(argc != 5){
+            printf("Error: %s wrong number of inputs:%d\n", argv[1], argc-1);
+            exit(EXIT_FAILURE);
+        }
+        return generate_trace(argv[2], strtoull(argv[3], NULL, 10), argv[4]);
+    }
+    if(argc > 1 && strcmp(argv[1], "verify") == 0){
+        if(argc > 4){
+            printf("Error: %s wrong number of inputs:%d\n", argv[1], argc-1);
+            exit(EXIT_FAILURE);
+        }
+        uint64_t branches = (argc >= 3) ? strtoull(argv[2], NULL, 10) : 4500000000ULL;
+        if(branches == 0){
+            printf("Error: Invalid size %s\n", argv[2]);
+            exit(EXIT_FAILURE);
+        }
+        // sim is the one next to bench
+        std::string sim = argv[0];
+        size_t slash = sim.rfind('/');
+        sim = (slash == std::string::npos) ? "sim" : sim.substr(0, slash + 1) + "sim";
+        std::string dir = (argc == 4) ? argv[3] : ".";
+        if(!verify_batch(dir, sim)){
+            printf("Error: verify failed\n");
+            exit(EXIT_FAILURE);
+        }
+        return verify(branches, dir, sim);
+    }
+
+    char default_sizes[] = "1000000,10000000,100000000";
+    char default_patterns[] = "loop,random,aliased";
+    char* sizes_list = default_sizes;
+    char* patterns_list = default_patterns;
+    bool json = false;
+    std::vector<bp_params> configs;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--sizes") == 0 && i + 1 < argc){
+            sizes_list = argv[++i];
+        } else if(strcmp(argv[i], "--patterns") == 0 && i + 1 < argc){
+            patterns_list = argv[++i];
+        } else if(strcmp(argv[i], "--json") == 0){
+            json = true;
+        } else if(strncmp(argv[i], "--", 2) == 0){
+            printf("Error: Unknown option %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        } else {
+            expand_sweep_spec(argv[i], configs);
+        }
+    }
+
+    if(configs.empty()){
+        for(size_t i = 0; i < sizeof(default_grid) / sizeof(default_grid[0]); i++){
+            expand_sweep_spec(default_grid[i], configs);
+        }
+    }
+
+    std::vector<char*> sizes = split_list(sizes_list);
+    std::vector<char*> patterns = split_list(patterns_list);
+    for(size_t p = 0; p < patterns.size(); p++){
+        SyntheticTrace check(patterns[p]);     // reject unknown patterns up front
+    }
+
+    if(!json){
+        printf("pattern,branches,predictor,K,M1,N,M2,seconds,branches_per_sec,ns_per_branch,peak_rss_kb,misprediction_rate\n");
+        fflush(stdout);
+    }
+    for(size_t p = 0; p < patterns.size(); p++){
+        for(size_t s = 0; s < sizes.size(); s++){
+            uint64_t branches = strtoull(sizes[s], NULL, 10);
+            if(branches == 0){
+                printf("Error: Invalid size %s\n", sizes[s]);
+                exit(EXIT_FAILURE);
+            }
+            for(size_t c = 0; c < configs.size(); c++){
+                pid_t pid = fork();
+                if(pid == 0){
+                    run_benchmark(patterns[p], branches, configs[c], json);
+                    _exit(0);
+                }
+                int status = 0;
+                if(pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+                    printf("Error: Benchmark %s %s on %s failed\n", configs[c].bp_name, sizes[s], patterns[p]);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -1,32 +1,36 @@
 #!/bin/bash
 
-# Output CSV header
-echo "m,trace,num_predictions,num_mispredictions,misprediction_rate" > output.csv
+# One batch job line per trace: simulate m from 7 to 20 on each of them
+manifest=bimodal_jobs.manifest
+rm -f $manifest
 
-# Loop over m from 7 to 20
-for m in {7..20}
+# Loop over each trace file
+for trace in gcc jpeg perl
 do
-    # Loop over each trace file
-    for trace in gcc jpeg perl
-    do
-        # Path to the trace file
-        tracefile="../tests/${trace}_trace.txt"
+    # Path to the trace file
+    tracefile="../tests/${trace}_trace.txt"
+
+    # Check if the trace file exists
+    if [[ ! -f $tracefile ]]; then
+        echo "Trace file $tracefile not found!"
+        continue
+    fi
 
-        # Check if the trace file exists
-        if [[ ! -f $tracefile ]]; then
-            echo "Trace file $tracefile not found!"
-            continue
-        fi
+    echo "$tracefile bimodal:7-20" >> $manifest
+done
 
-        # Run the simulation and capture the output
-        output=$(./sim bimodal $m $tracefile)
+# Output CSV header
+echo "m,trace,num_predictions,num_mispredictions,misprediction_rate" > output.csv
 
-        # Parse the output to extract required data
-        num_predictions=$(echo "$output" | grep -i "number of predictions" | awk '{print $NF}')
-        num_mispredictions=$(echo "$output" | grep -i "number of mispredictions" | awk '{print $NF}')
-        misprediction_rate=$(echo "$output" | grep -i "misprediction rate" | awk '{print $NF}' | tr -d '%')
+# Run every (trace, m) job in parallel on all cores. Jobs run by an earlier batch are read back from the
+# result cache in sim_cache instead.
+if [[ -f $manifest ]]; then
+    ./sim batch $manifest bimodal_batch.csv --cache sim_cache || exit 1
+    rm -f $manifest
 
-        # Append the data to the CSV file
-        echo "$m,$trace,$num_predictions,$num_mispredictions,$misprediction_rate" >> output.csv
-    done
-done
\ No newline at end of file
+    # The batch rows (trace path,predictor,K,M1,N,M2,...) come in manifest order, one trace after the
+    # other; cut them down to m, the trace name and the counts, in order of m and then trace
+    awk -F, 'NR > 1 { trace = $1; sub(/.*\//, "", trace); sub(/_trace\.txt$/, "", trace); print $6 "," trace "," $7 "," $8 "," $9 }' \
+        bimodal_batch.csv | sort -s -t, -k1,1n >> output.csv
+    rm -f bimodal_batch.csv
+fi
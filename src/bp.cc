@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim_bp.h"
+#include "bp.h"
+
+// Parse a single-configuration spec (every field a plain value, no ranges) into params. Returns false, with
+// the reason in message, if the spec is malformed or the predictor would reject its parameters.
+static bool parse_spec(char* spec, const char* original, bp_params* params, char* message, size_t size){
+    char* fields[5];
+    unsigned long int values[4];
+    int num_fields = 0;
+    char* save;
+
+    // strtok_r: hosts may build predictors from several threads at once
+    for(char* p = strtok_r(spec, ":", &save); p != NULL; p = strtok_r(NULL, ":", &save)){
+        if(num_fields == 5){
+            num_fields++;
+            break;
+        }
+        fields[num_fields++] = p;
+    }
+    for(int i = 1; i < num_fields && i < 5; i++){
+        char* end;
+        values[i - 1] = strtoul(fields[i], &end, 10);
+        if(end == fields[i] || *end != '\0'){
+            snprintf(message, size, "Invalid predictor spec %s", original);
+            return false;
+        }
+    }
+
+    memset(params, 0, sizeof(*params));
+    bp_type type = (num_fields > 0) ? get_bp_type(fields[0]) : BP_UNKNOWN;
+    if(type == BP_BIMODAL && num_fields == 2){
+        params->M2 = values[0];
+    } else if((type == BP_GSHARE || type == BP_PERCEPTRON) && num_fields == 3){
+        params->M1 = values[0];
+        params->N = values[1];
+    } else if((type == BP_HYBRID || type == BP_TAGE) && num_fields == 5){
+        params->K = values[0];
+        params->M1 = values[1];
+        params->N = values[2];
+        params->M2 = values[3];
+    } else {
+        snprintf(message, size, "Invalid predictor spec %s", original);
+        return false;
+    }
+    params->bp_name = fields[0];
+
+    // The checks the predictors' init would otherwise end the process on
+    if(type == BP_TAGE && !tage_predictor::valid_params(params->K, params->M1, params->N)){
+        snprintf(message, size, "Invalid tage parameters in %s (1 <= K <= %d, 1 <= M1 <= 24, N >= %d)", original,
+                 TAGE_MAX_TABLES, TAGE_MIN_HISTORY);
+        return false;
+    }
+    if(type == BP_PERCEPTRON && !perceptron_predictor::valid_params(params->M1, params->N)){
+        snprintf(message, size, "Invalid perceptron parameters in %s (M1 <= 24, 1 <= N <= 4096)", original);
+        return false;
+    }
+    return true;
+}
+
+BranchPredictor::BranchPredictor(const char* spec){
+    char copy[256];
+    bp_params params;
+
+    bht = NULL;
+    name[0] = '\0';
+    message[0] = '\0';
+    snprintf(copy, sizeof(copy), "%s", spec);
+    if(!parse_spec(copy, spec, &params, message, sizeof(message))){
+        return;
+    }
+    snprintf(name, sizeof(name), "%s", params.bp_name);
+    params.bp_name = name;
+    bht = new BranchHistoryTable(params);
+}
+
+BranchPredictor::~BranchPredictor(){
+    delete bht;
+}
+
+bool BranchPredictor::predict(uint64_t pc) const {
+    bool prediction = false;
+    if(bht == NULL){
+        return prediction;
+    }
+    bht->with_kernel([&](auto& kernel){
+        prediction = kernel.predict(pc);
+    });
+    return prediction;
+}
+
+void BranchPredictor::update(uint64_t pc, bool taken){
+    if(bht == NULL){
+        return;
+    }
+    bht->with_kernel([&](auto& kernel){
+        kernel.step(pc, taken);
+    });
+}
+
+bool BranchPredictor::predict_update(bp_span<const uint64_t> pcs, bp_span<const uint8_t> taken, uint64_t* mispredictions){
+    return predict_update(pcs, taken, bp_span<uint8_t>(), mispredictions);
+}
+
+bool BranchPredictor::predict_update(bp_span<const uint64_t> pcs, bp_span<const uint8_t> taken, bp_span<uint8_t> predictions,
+                                     uint64_t* mispredictions){
+    if(bht == NULL || taken.size() != pcs.size() || (!predictions.empty() && predictions.size() != pcs.size())){
+        return false;
+    }
+
+    uint64_t before = bht->number_of_mispredictions;
+    const uint64_t* pc = pcs.data();
+    const uint8_t* outcome = taken.data();
+    size_t count = pcs.size();
+    bht->with_kernel([&](auto& kernel){
+        if(predictions.empty()){
+            for(size_t i = 0; i < count; i++){
+                kernel.step(pc[i], outcome[i] != 0);
+            }
+        } else {
+            uint8_t* prediction = predictions.data();
+            for(size_t i = 0; i < count; i++){
+                prediction[i] = kernel.step(pc[i], outcome[i] != 0);
+            }
+        }
+    });
+    if(mispredictions != NULL){
+        *mispredictions = bht->number_of_mispredictions - before;
+    }
+    return true;
+}
+
+uint64_t BranchPredictor::predictions() const {
+    return (bht != NULL) ? bht->number_of_predictions : 0;
+}
+
+uint64_t BranchPredictor::mispredictions() const {
+    return (bht != NULL) ? bht->number_of_mispredictions : 0;
+}
@@ -0,0 +1,86 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#ifndef BP_H
+#define BP_H
+
+/*  Embeddable predictor library (libbp.a / libbp.so, "make lib")
+
+    BranchPredictor wraps one predictor of the simulator behind a small API for use from other models,
+    e.g. a cycle-level pipeline that predicts a branch at fetch and trains it at retire:
+
+        BranchPredictor bp("tage:7:10:200:12");     // same spec syntax as a sweep, one configuration
+        bool prediction = bp.predict(pc);
+        ...
+        bp.update(pc, taken);
+
+    predict() has no side effects. update() trains the predictor on the branch's outcome and shifts it into
+    the global history, counting a misprediction if the prediction (as predict() would have made it just
+    before) was wrong. Branches must be updated in program order; predicting a branch without updating it,
+    or updating it later than the next branch is predicted, is up to the caller.
+
+    predict_update() simulates a whole batch of branches, one predict and update each, in order, with the
+    predictor type dispatched once per batch instead of once per call, and optionally writes the
+    predictions out. None of the calls allocate memory; only the constructor does.
+
+    The library never prints or exits. A predictor built from an invalid spec is not valid(): error() says
+    why, predict() returns false and updates do nothing. predict_update() returns false, and simulates
+    nothing, if the batch lengths do not match or the predictor is not valid.
+*/
+
+// Non-owning view of count contiguous elements (std::span is C++20)
+template<class T>
+class bp_span{
+public:
+    bp_span() : ptr(NULL), count(0) {}
+    bp_span(T* ptr, size_t count) : ptr(ptr), count(count) {}
+    template<class U>
+    bp_span(std::vector<U>& v) : ptr(v.data()), count(v.size()) {}
+    template<class U>
+    bp_span(const std::vector<U>& v) : ptr(v.data()), count(v.size()) {}
+
+    T* data() const { return ptr; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T& operator[](size_t i) const { return ptr[i]; }
+
+private:
+    T*      ptr;
+    size_t  count;
+};
+
+class BranchHistoryTable;
+
+class BranchPredictor{
+public:
+    // spec: bimodal:M2, gshare:M1:N, perceptron:M1:N, hybrid:K:M1:N:M2 or tage:K:M1:N:M2 (see sweep.h)
+    explicit BranchPredictor(const char* spec);
+    ~BranchPredictor();
+
+    bool valid() const { return bht != NULL; }
+    const char* error() const { return message; }   // why the spec was rejected, "" if valid
+
+    bool predict(uint64_t pc) const;
+    void update(uint64_t pc, bool taken);
+
+    // Predict and update pcs[i] with outcome taken[i] (non-zero is taken) for every i in order. With
+    // predictions, predictions[i] is set to the prediction made for branch i. mispredictions, if not NULL,
+    // is set to the number of mispredictions in the batch.
+    bool predict_update(bp_span<const uint64_t> pcs, bp_span<const uint8_t> taken, uint64_t* mispredictions = NULL);
+    bool predict_update(bp_span<const uint64_t> pcs, bp_span<const uint8_t> taken, bp_span<uint8_t> predictions,
+                        uint64_t* mispredictions = NULL);
+
+    // Measurement counters over every update so far
+    uint64_t predictions() const;
+    uint64_t mispredictions() const;
+
+private:
+    BranchHistoryTable*     bht;
+    char                    name[16];       // bp_name of the configuration, which bht points to
+    char                    message[128];
+
+    BranchPredictor(const BranchPredictor&);
+    BranchPredictor& operator=(const BranchPredictor&);
+};
+
+#endif
@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "sim_bp.h"
+#include "cache.h"
+
+#define CACHE_HASH_PRIME1   0x9E3779B185EBCA87ULL
+#define CACHE_HASH_PRIME2   0xC2B2AE3D27D4EB4FULL
+#define CACHE_HASH_PRIME3   0x165667B19E3779F9ULL
+
+static inline uint64_t rotate_left(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+// 64-bit hash of the bytes of trace_file, one multiply-rotate round per 8 byte word
+static uint64_t hash_trace(const char* trace_file){
+    FILE* FP = fopen(trace_file, "rb");
+    if(FP == NULL){
+        printf("Error: Unable to open file %s\n", trace_file);
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<uint64_t> buffer(1 << 17);
+    uint64_t hash = CACHE_HASH_PRIME3;
+    uint64_t length = 0;
+    size_t bytes;
+    while((bytes = fread(&buffer[0], 1, buffer.size() * sizeof(uint64_t), FP)) > 0){
+        // Zero the tail of a partial last word so the result does not depend on stale buffer contents
+        size_t words = (bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        memset((char*)&buffer[0] + bytes, 0, words * sizeof(uint64_t) - bytes);
+        for(size_t i = 0; i < words; i++){
+            hash = rotate_left(hash + buffer[i] * CACHE_HASH_PRIME2, 31) * CACHE_HASH_PRIME1;
+        }
+        length += bytes;
+    }
+    bool failed = ferror(FP) != 0;
+    fclose(FP);
+    if(failed){
+        printf("Error: Unable to read file %s\n", trace_file);
+        exit(EXIT_FAILURE);
+    }
+
+    // Final avalanche, with the length so that trailing zero bytes count
+    hash ^= length;
+    hash ^= hash >> 33;
+    hash *= CACHE_HASH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= CACHE_HASH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+static void make_dir(const std::string& path){
+    if(mkdir(path.c_str(), 0777) != 0 && errno != EEXIST){
+        printf("Error: Unable to create directory %s\n", path.c_str());
+        exit(EXIT_FAILURE);
+    }
+}
+
+// A name next to path that no other process or thread writes at the same time
+static std::string temporary_name(const std::string& path){
+    static std::atomic<unsigned long> next(0);
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".tmp.%ld.%lu", (long)getpid(), next++);
+    return path + suffix;
+}
+
+// Write text to path through a temporary file renamed into place
+static void write_file(const std::string& path, const char* text){
+    std::string tmp_file = temporary_name(path);
+    FILE* FP = fopen(tmp_file.c_str(), "w");
+    if(FP == NULL){
+        printf("Error: Unable to open file %s\n", tmp_file.c_str());
+        exit(EXIT_FAILURE);
+    }
+    fputs(text, FP);
+    bool failed = ferror(FP) != 0;
+    failed = (fclose(FP) != 0) || failed;
+    if(failed || rename(tmp_file.c_str(), path.c_str()) != 0){
+        printf("Error: Unable to write file %s\n", path.c_str());
+        exit(EXIT_FAILURE);
+    }
+}
+
+ResultCache::ResultCache(const char* cache_dir, const char* trace_file){
+    // The key is taken from the trace file itself, before it is read, so standard input cannot be cached
+    if(strcmp(trace_file, "-") == 0){
+        printf("Error: --cache requires a trace file, not standard input\n");
+        exit(EXIT_FAILURE);
+    }
+    struct stat info;
+    if(stat(trace_file, &info) != 0){
+        printf("Error: Unable to open file %s\n", trace_file);
+        exit(EXIT_FAILURE);
+    }
+    if(!S_ISREG(info.st_mode)){
+        printf("Error: --cache requires a trace file, not %s\n", trace_file);
+        exit(EXIT_FAILURE);
+    }
+    make_dir(cache_dir);
+    make_dir(std::string(cache_dir) + "/traces");
+
+    // Step 1: Look up the hash of this version of the trace file, hashing it the first time
+#ifdef __APPLE__
+    long mtime_nsec = (long)info.st_mtimespec.tv_nsec;
+#else
+    long mtime_nsec = (long)info.st_mtim.tv_nsec;
+#endif
+    char name[128];
+    snprintf(name, sizeof(name), "/traces/%llu-%llu-%llu-%lld.%09ld", (unsigned long long)info.st_dev,
+             (unsigned long long)info.st_ino, (unsigned long long)info.st_size, (long long)info.st_mtime, mtime_nsec);
+    std::string identity = std::string(cache_dir) + name;
+
+    unsigned long long known;
+    FILE* FP = fopen(identity.c_str(), "r");
+    if(FP != NULL && fscanf(FP, "%llx", &known) == 1){
+        hash = known;
+    } else {
+        hash = hash_trace(trace_file);
+        char text[32];
+        snprintf(text, sizeof(text), "%016llx\n", (unsigned long long)hash);
+        write_file(identity, text);
+    }
+    if(FP != NULL){
+        fclose(FP);
+    }
+
+    // Step 2: The entries of the trace live in a directory named after its hash, under the cache version
+    snprintf(name, sizeof(name), "/v%d", SIM_CACHE_VERSION);
+    dir = std::string(cache_dir) + name;
+    make_dir(dir);
+    snprintf(name, sizeof(name), "/%016llx", (unsigned long long)hash);
+    dir += name;
+    make_dir(dir);
+}
+
+std::string ResultCache::entry(const bp_params& params, const char* suffix) const {
+    char name[160];
+    snprintf(name, sizeof(name), "/%s-%lu-%lu-%lu-%lu%s", params.bp_name, params.K, params.M1, params.N, params.M2, suffix);
+    return dir + name;
+}
+
+bool ResultCache::read_entry(const bp_params& params, uint64_t* predictions, uint64_t* mispredictions, bool* snapshot) const {
+    FILE* FP = fopen(entry(params, ".result").c_str(), "r");
+    if(FP == NULL){
+        return false;
+    }
+    char bp_name[32];
+    unsigned long K, M1, N, M2;
+    unsigned long long num_predictions, num_mispredictions;
+    int has_snapshot;
+    bool found = fscanf(FP, "%31s %lu %lu %lu %lu %llu %llu %d", bp_name, &K, &M1, &N, &M2,
+                        &num_predictions, &num_mispredictions, &has_snapshot) == 8 &&
+                 strcmp(bp_name, params.bp_name) == 0 && K == params.K && M1 == params.M1 && N == params.N && M2 == params.M2;
+    fclose(FP);
+    if(found){
+        *predictions = num_predictions;
+        *mispredictions = num_mispredictions;
+        *snapshot = has_snapshot != 0;
+    }
+    return found;
+}
+
+void ResultCache::write_entry(const bp_params& params, uint64_t predictions, uint64_t mispredictions, bool snapshot) const {
+    char text[256];
+    snprintf(text, sizeof(text), "%s %lu %lu %lu %lu %llu %llu %d\n", params.bp_name, params.K, params.M1, params.N, params.M2,
+             (unsigned long long)predictions, (unsigned long long)mispredictions, snapshot ? 1 : 0);
+    write_file(entry(params, ".result"), text);
+}
+
+bool ResultCache::lookup(const bp_params& params, uint64_t* predictions, uint64_t* mispredictions) const {
+    bool snapshot;
+    return read_entry(params, predictions, mispredictions, &snapshot);
+}
+
+bool ResultCache::lookup(BranchHistoryTable& BHT, bool tables) const {
+    uint64_t predictions, mispredictions;
+    bool snapshot;
+    if(!read_entry(BHT.bp_param, &predictions, &mispredictions, &snapshot) || (tables && !snapshot)){
+        return false;
+    }
+    if(tables){
+        std::string snapshot_file = entry(BHT.bp_param, ".snap");
+        if(access(snapshot_file.c_str(), R_OK) != 0){
+            return false;
+        }
+        BHT.load_snapshot(snapshot_file.c_str(), true);
+    }
+    BHT.number_of_predictions = predictions;
+    BHT.number_of_mispredictions = mispredictions;
+    return true;
+}
+
+void ResultCache::store(const bp_params& params, uint64_t predictions, uint64_t mispredictions) const {
+    // Never replace an entry, which may hold a snapshot, with one that does not
+    uint64_t known_predictions, known_mispredictions;
+    bool snapshot;
+    if(!read_entry(params, &known_predictions, &known_mispredictions, &snapshot)){
+        write_entry(params, predictions, mispredictions, false);
+    }
+}
+
+void ResultCache::store(BranchHistoryTable& BHT, bool tables) const {
+    uint64_t known_predictions, known_mispredictions;
+    bool snapshot;
+    if(read_entry(BHT.bp_param, &known_predictions, &known_mispredictions, &snapshot) && (snapshot || !tables)){
+        return;
+    }
+
+    // The snapshot goes into place before the result that refers to it
+    if(tables){
+        std::string snapshot_file = entry(BHT.bp_param, ".snap");
+        std::string tmp_file = temporary_name(snapshot_file);
+        BHT.save_snapshot(tmp_file.c_str(), BHT.number_of_predictions);
+        if(rename(tmp_file.c_str(), snapshot_file.c_str()) != 0){
+            printf("Error: Unable to write file %s\n", snapshot_file.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+    write_entry(BHT.bp_param, BHT.number_of_predictions, BHT.number_of_mispredictions, tables);
+}
@@ -0,0 +1,53 @@
+#include <stdint.h>
+#include <string>
+#include "sim_bp.h"
+#ifndef CACHE_H
+#define CACHE_H
+
+/*  Persistent result cache (--cache DIR)
+
+    Results are keyed by SIM_CACHE_VERSION, a 64-bit content hash of the trace file and the full bp_params,
+    and kept under cache_dir as
+
+        cache_dir/v<version>/<trace hash>/<bp_name>-<K>-<M1>-<N>-<M2>.result     "<bp_name> K M1 N M2 predictions mispredictions snapshot"
+        cache_dir/v<version>/<trace hash>/<bp_name>-<K>-<M1>-<N>-<M2>.snap       final predictor state (see save_snapshot), if snapshot is 1
+
+    SIM_CACHE_VERSION must be bumped whenever a change to the simulator can change a result (predictor
+    behavior, trace parsing, counting) or changes the snapshot layout, so that entries written by an older
+    sim are never served; their directories can simply be deleted.
+
+    The trace hash is remembered in cache_dir/traces/, keyed by the trace's device, inode, size and
+    modification time, so a hit does not read the trace again; editing the trace changes its mtime and
+    forces a rehash. Every file is written under a name unique to the writing process and thread and then
+    renamed into place, and the snapshot before the result that refers to it, so any number of processes
+    can share one cache directory: a reader sees either a complete entry or none, and concurrent writers
+    of the same entry write the same contents.
+*/
+#define SIM_CACHE_VERSION   3
+
+class ResultCache{
+public:
+    // Open (creating if needed) cache_dir and hash trace_file; exits if either is not accessible
+    ResultCache(const char* cache_dir, const char* trace_file);
+
+    // Look up the counts of params. Returns false on a miss.
+    bool lookup(const bp_params& params, uint64_t* predictions, uint64_t* mispredictions) const;
+
+    // Look up BHT's configuration and restore its counters; with tables, the entry must also hold the final
+    // predictor state, which is loaded into BHT. Returns false (leaving BHT untouched) on a miss.
+    bool lookup(BranchHistoryTable& BHT, bool tables) const;
+
+    // Store the counts of params, or BHT's counters and, with tables, its final predictor state
+    void store(const bp_params& params, uint64_t predictions, uint64_t mispredictions) const;
+    void store(BranchHistoryTable& BHT, bool tables) const;
+
+private:
+    std::string dir;            // cache_dir/v<version>/<trace hash>
+    uint64_t    hash;
+
+    std::string entry(const bp_params& params, const char* suffix) const;
+    bool read_entry(const bp_params& params, uint64_t* predictions, uint64_t* mispredictions, bool* snapshot) const;
+    void write_entry(const bp_params& params, uint64_t predictions, uint64_t mispredictions, bool snapshot) const;
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <set>
+#include <algorithm>
+#ifndef COUNTER_TABLE_H
+#define COUNTER_TABLE_H
+
+// Counter policy: Bits wide saturating counter, predicting taken in the upper half of its range
+template<int Bits>
+struct saturating_counter{
+    static const int bits = Bits;
+    static const int max = (1 << Bits) - 1;
+    static const int threshold = 1 << (Bits - 1);
+
+    static bool predict(int counter){
+        return counter >= threshold;
+    }
+};
+typedef saturating_counter<2> counter_2bit;
+
+/*  Table of saturating counters packed Counter::bits to a counter into 64-bit words (32 two-bit counters
+    per word instead of one per int), so large tables stay in cache. Counters never straddle a word, so
+    Counter::bits has to divide 64.
+*/
+template<class Counter>
+class packed_counter_table{
+public:
+    typedef Counter counter;
+
+    packed_counter_table() : entries(0) {}
+
+    // Resize to n counters, all set to value
+    void resize(size_t n, int value){
+        uint64_t word = 0;
+        for(int i = 0; i < per_word; i++){
+            word |= (uint64_t)value << (i * Counter::bits);
+        }
+        words.assign((n + per_word - 1) / per_word, word);
+        entries = n;
+    }
+
+    size_t size() const {
+        return entries;
+    }
+
+    int get(size_t i) const {
+        return (int)((words[i / per_word] >> shift_of(i)) & Counter::max);
+    }
+
+    void set(size_t i, int value){
+        uint64_t& word = words[i / per_word];
+        word = (word & ~((uint64_t)Counter::max << shift_of(i))) | ((uint64_t)value << shift_of(i));
+    }
+
+    bool predict(size_t i) const {
+        return Counter::predict(get(i));
+    }
+
+    // Increment if taken, decrement if not-taken, saturating at the extremes (0 and max). Branch-free: the
+    // counter field is adjusted in place, and saturation guarantees no carry or borrow leaves the field.
+    void update(size_t i, bool taken){
+        uint64_t& word = words[i / per_word];
+        unsigned int shift = shift_of(i);
+        uint64_t value = (word >> shift) & Counter::max;
+        uint64_t increment = (uint64_t)(taken & (value != (uint64_t)Counter::max));
+        uint64_t decrement = (uint64_t)(!taken & (value != 0));
+        word = word + (increment << shift) - (decrement << shift);
+    }
+
+    // Raw packed storage, for snapshots: per_word counters per word, counter i in word i / per_word
+    size_t num_words() const {
+        return words.size();
+    }
+    bool write(FILE* FP) const {
+        return words.empty() || fwrite(&words[0], sizeof(uint64_t), words.size(), FP) == words.size();
+    }
+    bool read(FILE* FP){
+        return words.empty() || fread(&words[0], sizeof(uint64_t), words.size(), FP) == words.size();
+    }
+
+    // First counter at or after i that may differ from the value the table was resized with
+    size_t first_touched(size_t i) const {
+        return i;
+    }
+
+    static const int per_word = 64 / Counter::bits;
+
+private:
+    static_assert(64 % Counter::bits == 0, "counter width must divide 64");
+
+    static unsigned int shift_of(size_t i){
+        return (unsigned int)(i % per_word) * Counter::bits;
+    }
+
+    std::vector<uint64_t>   words;
+    size_t                  entries;
+};
+
+/*  The same table for very large index widths: the packed words are split into pages of
+    SPARSE_PAGE_WORDS, and a page is only allocated when one of its counters is first updated. Until then
+    every counter in it reads as the value the table was resized with. Pages are found through a two-level
+    directory: a top level allocated zeroed by the OS, pointing to blocks of SPARSE_BLOCK_PAGES page
+    pointers that are only allocated along with their first page. The numbers of the allocated pages are
+    also kept in order, so skipping untouched pages and freeing the table cost time in the pages touched,
+    not in the index width. Predictions and updates give exactly the results of packed_counter_table, at
+    the cost of two extra loads per access.
+*/
+#define SPARSE_PAGE_WORDS   512         // 4KB pages
+#define SPARSE_BLOCK_PAGES  512         // 4KB directory blocks, covering 2MB of counters each
+
+template<class Counter>
+class sparse_counter_table{
+public:
+    typedef Counter counter;
+
+    sparse_counter_table() : directory(NULL), num_blocks(0), num_pages(0), words(0), entries(0), fill(0) {}
+    ~sparse_counter_table(){
+        release();
+    }
+
+    // Resize to n counters, all set to value (no page is allocated yet)
+    void resize(size_t n, int value){
+        release();
+        fill = 0;
+        for(int i = 0; i < per_word; i++){
+            fill |= (uint64_t)value << (i * Counter::bits);
+        }
+        entries = n;
+        words = (n + per_word - 1) / per_word;
+        num_pages = (words + SPARSE_PAGE_WORDS - 1) / SPARSE_PAGE_WORDS;
+        num_blocks = (num_pages + SPARSE_BLOCK_PAGES - 1) / SPARSE_BLOCK_PAGES;
+        directory = (uint64_t***)calloc(num_blocks ? num_blocks : 1, sizeof(uint64_t**));
+        if(directory == NULL){
+            printf("Error: Unable to allocate a sparse table of %llu counters\n", (unsigned long long)n);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t size() const {
+        return entries;
+    }
+
+    int get(size_t i) const {
+        return (int)((word(i / per_word) >> shift_of(i)) & Counter::max);
+    }
+
+    void set(size_t i, int value){
+        uint64_t& word = writable_word(i / per_word);
+        word = (word & ~((uint64_t)Counter::max << shift_of(i))) | ((uint64_t)value << shift_of(i));
+    }
+
+    bool predict(size_t i) const {
+        return Counter::predict(get(i));
+    }
+
+    // Same branch-free update as packed_counter_table, allocating the counter's page first if needed
+    void update(size_t i, bool taken){
+        uint64_t& word = writable_word(i / per_word);
+        unsigned int shift = shift_of(i);
+        uint64_t value = (word >> shift) & Counter::max;
+        uint64_t increment = (uint64_t)(taken & (value != (uint64_t)Counter::max));
+        uint64_t decrement = (uint64_t)(!taken & (value != 0));
+        word = word + (increment << shift) - (decrement << shift);
+    }
+
+    // Packed words in the same layout as packed_counter_table, so snapshots are interchangeable. Pages
+    // read back holding only the initial value stay unallocated.
+    size_t num_words() const {
+        return words;
+    }
+    bool write(FILE* FP) const {
+        std::vector<uint64_t> untouched(SPARSE_PAGE_WORDS, fill);
+        for(size_t p = 0; p < num_pages; p++){
+            size_t n = page_length(p);
+            const uint64_t* data = page(p);
+            if(fwrite(data ? data : &untouched[0], sizeof(uint64_t), n, FP) != n){
+                return false;
+            }
+        }
+        return true;
+    }
+    bool read(FILE* FP){
+        std::vector<uint64_t> data(SPARSE_PAGE_WORDS);
+        for(size_t p = 0; p < num_pages; p++){
+            size_t n = page_length(p);
+            if(fread(&data[0], sizeof(uint64_t), n, FP) != n){
+                return false;
+            }
+            bool initial = true;
+            for(size_t k = 0; k < n; k++){
+                initial = initial && data[k] == fill;
+            }
+            if(!initial || page(p) != NULL){
+                for(size_t k = 0; k < n; k++){
+                    writable_word(p * SPARSE_PAGE_WORDS + k) = data[k];
+                }
+            }
+        }
+        return true;
+    }
+
+    // First counter at or after i that may differ from the value the table was resized with: pages that
+    // were never updated, and words still holding only the initial value, are skipped
+    size_t first_touched(size_t i) const {
+        size_t w = i / per_word;
+        while(w < words){
+            const uint64_t* data = page(w / SPARSE_PAGE_WORDS);
+            if(data == NULL){
+                std::set<size_t>::const_iterator next = touched.lower_bound(w / SPARSE_PAGE_WORDS);
+                if(next == touched.end()){
+                    break;
+                }
+                w = *next * SPARSE_PAGE_WORDS;
+            } else if(data[w % SPARSE_PAGE_WORDS] == fill){
+                w++;
+            } else {
+                return std::min(std::max(i, w * per_word), entries);
+            }
+        }
+        return entries;
+    }
+
+    // Number of allocated pages
+    size_t pages_touched() const {
+        return touched.size();
+    }
+
+    static const int per_word = 64 / Counter::bits;
+
+private:
+    static_assert(64 % Counter::bits == 0, "counter width must divide 64");
+
+    static unsigned int shift_of(size_t i){
+        return (unsigned int)(i % per_word) * Counter::bits;
+    }
+
+    // Page p, or NULL if it was never updated
+    const uint64_t* page(size_t p) const {
+        uint64_t** block = directory[p / SPARSE_BLOCK_PAGES];
+        return block ? block[p % SPARSE_BLOCK_PAGES] : NULL;
+    }
+
+    uint64_t word(size_t w) const {
+        const uint64_t* data = page(w / SPARSE_PAGE_WORDS);
+        return data ? data[w % SPARSE_PAGE_WORDS] : fill;
+    }
+
+    uint64_t& writable_word(size_t w){
+        size_t p = w / SPARSE_PAGE_WORDS;
+        uint64_t**& block = directory[p / SPARSE_BLOCK_PAGES];
+        if(block == NULL){
+            block = new uint64_t*[SPARSE_BLOCK_PAGES]();
+        }
+        uint64_t*& data = block[p % SPARSE_BLOCK_PAGES];
+        if(data == NULL){
+            data = new uint64_t[SPARSE_PAGE_WORDS];
+            for(size_t k = 0; k < SPARSE_PAGE_WORDS; k++){
+                data[k] = fill;
+            }
+            touched.insert(p);
+        }
+        return data[w % SPARSE_PAGE_WORDS];
+    }
+
+    size_t page_length(size_t p) const {
+        return std::min((size_t)SPARSE_PAGE_WORDS, words - p * SPARSE_PAGE_WORDS);
+    }
+
+    void release(){
+        // Every allocated block holds at least one touched page
+        for(std::set<size_t>::const_iterator p = touched.begin(); p != touched.end(); ++p){
+            uint64_t**& block = directory[*p / SPARSE_BLOCK_PAGES];
+            delete[] block[*p % SPARSE_BLOCK_PAGES];
+            std::set<size_t>::const_iterator next = p;
+            ++next;
+            if(next == touched.end() || *next / SPARSE_BLOCK_PAGES != *p / SPARSE_BLOCK_PAGES){
+                delete[] block;
+                block = NULL;
+            }
+        }
+        free(directory);
+        directory = NULL;
+        touched.clear();
+        num_blocks = 0;
+        num_pages = 0;
+    }
+
+    uint64_t***         directory;      // num_blocks blocks of page pointers, NULL for blocks never updated
+    size_t              num_blocks;
+    size_t              num_pages;
+    size_t              words;
+    size_t              entries;
+    uint64_t            fill;           // a word of counters at the initial value
+    std::set<size_t>    touched;        // numbers of the allocated pages, in order
+
+    sparse_counter_table(const sparse_counter_table&);
+    sparse_counter_table& operator=(const sparse_counter_table&);
+};
+
+#endif
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "sim_bp.h"
+#include "trace.h"
+#include "sweep.h"
+#include "explore.h"
+
+// One configuration of the search and its counts over the last prefix it was simulated on
+typedef struct explore_candidate{
+    bp_params           params;
+    uint64_t            storage;            // bits
+    uint64_t            predictions;
+    uint64_t            mispredictions;
+    size_t              layer;              // Pareto layer in the last ranking, 0 for the frontier
+}explore_candidate;
+
+// Storage of a configuration in bits, 0 for the predictor types explore does not size
+static uint64_t storage_bits(const bp_params& p){
+    if(strcmp(p.bp_name, "bimodal") == 0){
+        return (uint64_t)2 << p.M2;
+    } else if(strcmp(p.bp_name, "gshare") == 0){
+        return ((uint64_t)2 << p.M1) + p.N;
+    } else if(strcmp(p.bp_name, "hybrid") == 0){
+        return ((uint64_t)2 << p.K) + ((uint64_t)2 << p.M1) + p.N + ((uint64_t)2 << p.M2);
+    }
+    return 0;
+}
+
+// Simulate the candidates ids over the first prefix branches of the trace, each from a fresh predictor
+static void evaluate(const char* trace_file, std::vector<explore_candidate>& candidates, const std::vector<size_t>& ids, uint64_t prefix){
+    for(size_t first = 0; first < ids.size(); ){
+        // Step 1: Build as many predictors as fit in EXPLORE_GROUP_BITS (at least one)
+        std::vector<BranchHistoryTable*> group;
+        uint64_t bits = 0;
+        size_t last = first;
+        while(last < ids.size() && (group.empty() || bits + candidates[ids[last]].storage <= EXPLORE_GROUP_BITS)){
+            group.push_back(new BranchHistoryTable(candidates[ids[last]].params));
+            bits += candidates[ids[last]].storage;
+            last++;
+        }
+
+        // Step 2: Run them over the prefix together
+        TraceReader trace;
+        if(!trace.open(trace_file)){
+            printf("Error: Unable to open file %s\n", trace_file);
+            exit(EXIT_FAILURE);
+        }
+        run_sweep_predictors(trace, group, prefix);
+
+        for(size_t i = 0; i < group.size(); i++){
+            explore_candidate& c = candidates[ids[first + i]];
+            c.predictions = group[i]->number_of_predictions;
+            c.mispredictions = group[i]->number_of_mispredictions;
+            delete group[i];
+        }
+        first = last;
+    }
+}
+
+// Non-dominated sorting of the candidates ids, all simulated over the same prefix: layer 0 holds the ones
+// no other candidate matches or beats on both storage and mispredictions, layer 1 the ones only layer 0
+// does, and so on. Sorting by storage lets each candidate find its layer by binary search over the lowest
+// mispredictions seen in every layer so far, which increase from layer to layer.
+static void rank_pareto_layers(std::vector<explore_candidate>& candidates, std::vector<size_t>& ids){
+    std::sort(ids.begin(), ids.end(), [&](size_t a, size_t b){
+        if(candidates[a].storage != candidates[b].storage){
+            return candidates[a].storage < candidates[b].storage;
+        }
+        return candidates[a].mispredictions < candidates[b].mispredictions;
+    });
+
+    std::vector<uint64_t> lowest;
+    for(size_t i = 0; i < ids.size(); i++){
+        explore_candidate& c = candidates[ids[i]];
+        size_t layer = std::upper_bound(lowest.begin(), lowest.end(), c.mispredictions) - lowest.begin();
+        if(layer == lowest.size()){
+            lowest.push_back(c.mispredictions);
+        } else {
+            lowest[layer] = c.mispredictions;
+        }
+        c.layer = layer;
+    }
+}
+
+// Keep at least keep of the ranked candidates ids, taking whole layers, frontier first
+static void prune(std::vector<explore_candidate>& candidates, std::vector<size_t>& ids, size_t keep){
+    std::stable_sort(ids.begin(), ids.end(), [&](size_t a, size_t b){
+        return candidates[a].layer < candidates[b].layer;
+    });
+    keep = std::max<size_t>(keep, 1);
+    while(keep < ids.size() && candidates[ids[keep]].layer == candidates[ids[keep - 1]].layer){
+        keep++;
+    }
+    ids.resize(keep);
+}
+
+static void write_explore_row(FILE* csv, const char* trace_file, const explore_candidate& c){
+    const bp_params& p = c.params;
+    double misprediction_rate = (static_cast<double>(c.mispredictions) / static_cast<double>(c.predictions)) * 100;
+
+    fprintf(csv, "%s,%s,", trace_file, p.bp_name);
+    if(strcmp(p.bp_name, "bimodal") == 0){
+        fprintf(csv, ",,,%lu,", p.M2);
+    } else if(strcmp(p.bp_name, "gshare") == 0){
+        fprintf(csv, ",%lu,%lu,,", p.M1, p.N);
+    } else {
+        fprintf(csv, "%lu,%lu,%lu,%lu,", p.K, p.M1, p.N, p.M2);
+    }
+    fprintf(csv, "%llu,%llu,%llu,%.2f\n", (unsigned long long)c.storage, (unsigned long long)c.predictions,
+            (unsigned long long)c.mispredictions, misprediction_rate);
+}
+
+int run_explore(const char* trace_file, const char* csv_file, uint64_t budget_bits, int num_specs, char* specs[]){
+    // Step 1: Expand the specs, a bare family name into its full range, and keep what fits in the budget.
+    // The predictor names of the configurations point into the spec strings, so those are copied to
+    // storage that lives as long as the search.
+    std::vector<std::vector<char> > spec_text(num_specs);
+    std::vector<bp_params> configs;
+    for(int i = 0; i < num_specs; i++){
+        const char* spec = specs[i];
+        if(strcmp(spec, "bimodal") == 0){
+            spec = "bimodal:1-30";
+        } else if(strcmp(spec, "gshare") == 0){
+            spec = "gshare:1-30:0-30";
+        } else if(strcmp(spec, "hybrid") == 0){
+            spec = "hybrid:1-30:1-30:0-30:1-30";
+        }
+        spec_text[i].assign(spec, spec + strlen(spec) + 1);
+        expand_sweep_spec(&spec_text[i][0], configs);
+    }
+
+    std::vector<explore_candidate> candidates;
+    for(size_t i = 0; i < configs.size(); i++){
+        explore_candidate c;
+        memset(&c, 0, sizeof(c));
+        c.params = configs[i];
+        c.storage = storage_bits(configs[i]);
+        if(c.storage == 0){
+            printf("Error: explore only searches bimodal, gshare and hybrid, not %s\n", configs[i].bp_name);
+            exit(EXIT_FAILURE);
+        }
+        if(c.storage <= budget_bits){
+            candidates.push_back(c);
+        }
+    }
+    if(candidates.empty()){
+        printf("Error: No configuration fits in %llu bits\n", (unsigned long long)budget_bits);
+        exit(EXIT_FAILURE);
+    }
+
+    TraceReader trace;
+    if(!trace.open(trace_file)){
+        printf("Error: Unable to open file %s\n", trace_file);
+        exit(EXIT_FAILURE);
+    }
+    if(!trace.is_binary()){
+        printf("Error: explore needs a binary trace (see sim convert)\n");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t length = trace.length();
+    trace.close();
+
+    FILE* csv = fopen(csv_file, "w");
+    if(csv == NULL){
+        printf("Error: Unable to open file %s\n", csv_file);
+        exit(EXIT_FAILURE);
+    }
+
+    // Step 2: Successive halving. Round r < rounds runs the survivors over the first length >> (rounds - r)
+    // branches and keeps the fraction ratio of them, at most half, chosen to leave about EXPLORE_FINALISTS
+    // for the last round, which runs them over the whole trace.
+    int rounds = (candidates.size() > EXPLORE_FINALISTS) ? EXPLORE_FIRST_PREFIX_SHIFT : 0;
+    double ratio = std::min(0.5, pow((double)EXPLORE_FINALISTS / candidates.size(), 1.0 / std::max(rounds, 1)));
+    std::vector<size_t> survivors(candidates.size());
+    for(size_t i = 0; i < survivors.size(); i++){
+        survivors[i] = i;
+    }
+    uint64_t simulated = 0;     // branches simulated over all candidates and rounds
+    for(int r = 0; r <= rounds; r++){
+        uint64_t prefix = length >> (rounds - r);
+        printf("round %d: %lu configurations over %llu branches\n", r, (unsigned long)survivors.size(), (unsigned long long)prefix);
+        evaluate(trace_file, candidates, survivors, prefix);
+        simulated += survivors.size() * prefix;
+        rank_pareto_layers(candidates, survivors);
+        if(r < rounds){
+            prune(candidates, survivors, (size_t)ceil(survivors.size() * ratio));
+        }
+    }
+
+    // Step 3: Write the frontier of the finalists
+    std::vector<size_t> frontier;
+    for(size_t i = 0; i < survivors.size(); i++){
+        if(candidates[survivors[i]].layer == 0){
+            frontier.push_back(survivors[i]);
+        }
+    }
+    std::sort(frontier.begin(), frontier.end(), [&](size_t a, size_t b){
+        return candidates[a].storage < candidates[b].storage;
+    });
+    fprintf(csv, "trace,predictor,K,M1,N,M2,storage_bits,num_predictions,num_mispredictions,misprediction_rate\n");
+    for(size_t i = 0; i < frontier.size(); i++){
+        write_explore_row(csv, trace_file, candidates[frontier[i]]);
+    }
+    if(fclose(csv) != 0){
+        printf("Error: Unable to write file %s\n", csv_file);
+        exit(EXIT_FAILURE);
+    }
+
+    double exhaustive = (double)candidates.size() * (double)length;
+    printf("frontier of %lu configurations, simulated %.1f%% of the branches of an exhaustive sweep\n",
+           (unsigned long)frontier.size(), exhaustive > 0 ? simulated / exhaustive * 100 : 0.0);
+    return (int)candidates.size();
+}
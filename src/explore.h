@@ -0,0 +1,34 @@
+#include <stdint.h>
+#ifndef EXPLORE_H
+#define EXPLORE_H
+
+/*  Budget-constrained design-space search ("sim explore")
+
+    Finds the Pareto frontier of misprediction rate versus storage among the configurations that fit in
+    budget_bits, without simulating every one of them over the whole trace. Each spec is a predictor family,
+    bimodal, gshare or hybrid, standing for all of its configurations with index widths up to 30, or a sweep
+    spec of one of them (see sweep.h) to search a narrower range. Storage counts 2 bits per counter of every
+    table plus the N bits of global history:
+
+        bimodal     2 * 2^M2
+        gshare      2 * 2^M1 + N
+        hybrid      2 * 2^K + 2 * 2^M1 + N + 2 * 2^M2
+
+    The search is successive halving over growing prefixes of the trace. All candidates are simulated over
+    the first 1/2^EXPLORE_FIRST_PREFIX_SHIFT of the trace, and those furthest from the frontier are dropped,
+    by non-dominated sorting on storage and mispredictions, so every configuration on the prefix's frontier
+    survives. At least half are dropped, or more if needed to get down to about EXPLORE_FINALISTS in the
+    rounds there are. The survivors are simulated again over a prefix twice as long, and so on, and the
+    finalists run the whole trace. Each prefix is simulated from a fresh predictor, at most
+    EXPLORE_GROUP_BITS of tables at a time, in lockstep as in a sweep.
+
+    trace_file must be a binary trace. The frontier found on the whole trace is written to csv_file, one
+    row per configuration in order of storage. Returns the number of candidates searched.
+*/
+#define EXPLORE_FINALISTS               32
+#define EXPLORE_FIRST_PREFIX_SHIFT      5
+#define EXPLORE_GROUP_BITS              (8ULL << 30)    // 1GB of tables
+
+int run_explore(const char* trace_file, const char* csv_file, uint64_t budget_bits, int num_specs, char* specs[]);
+
+#endif
@@ -1,8 +1,5 @@
 #!/bin/bash
 
-# Output CSV header
-echo "m,n,num_predictions,num_mispredictions,misprediction_rate" > gshare_output.csv
-
 # Path to the trace file
 tracefile="../tests/gcc_trace.txt"
 
@@ -12,24 +9,18 @@ if [[ ! -f $tracefile ]]; then
     exit 1
 fi
 
-# Loop over m from 7 to 20
+# Simulate every (m, n) pair with m from 7 to 20 and n from 0 to m in a single pass over the trace, one
+# sweep spec per m. Pairs simulated by an earlier run are read back from the result cache in sim_cache
+# instead.
+specs=""
 for (( m=7; m<=20; m++ ))
 do
-    # Loop over n from 0 to m
-    for (( n=0; n<=m; n++ ))
-    do
-        # Run the simulation and capture the output
-        output=$(./sim gshare $m $n $tracefile)
-
-        # Parse the output to extract required data
-        num_predictions=$(echo "$output" | grep -i "number of predictions" | awk '{print $NF}')
-        num_mispredictions=$(echo "$output" | grep -i "number of mispredictions" | awk '{print $NF}')
-        misprediction_rate=$(echo "$output" | grep -i "misprediction rate" | awk '{print $NF}' | tr -d '%')
+    specs="$specs gshare:$m:0-$m"
+done
+./sim sweep $tracefile gshare_sweep.csv $specs --cache sim_cache || exit 1
 
-        # Append the data to the CSV file
-        echo "$m,$n,$num_predictions,$num_mispredictions,$misprediction_rate" >> gshare_output.csv
-
-        # Optional: Print progress
-        echo "Completed m=$m, n=$n"
-    done
-done
\ No newline at end of file
+# Output CSV: the sweep rows (trace,predictor,K,M1,N,M2,...) cut down to m,n and the counts, already in
+# order of m, then n
+echo "m,n,num_predictions,num_mispredictions,misprediction_rate" > gshare_output.csv
+awk -F, 'NR > 1 { print $4 "," $5 "," $7 "," $8 "," $9 }' gshare_sweep.csv >> gshare_output.csv
+rm -f gshare_sweep.csv
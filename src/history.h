@@ -0,0 +1,71 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#ifndef HISTORY_H
+#define HISTORY_H
+
+/*  Long global branch history
+
+    history_buffer keeps the most recent outcomes, one per byte, in a circular buffer whose size is a power
+    of two, so any history length is supported and reading the bit that is about to leave a window of length
+    L is a single masked load. folded_history compresses the newest L bits down to W bits by XORing W-bit
+    chunks together (Seznec's "folded history"), updated in O(1) per branch from the bit entering and the bit
+    leaving the window, so the cost per branch does not grow with L.
+*/
+class history_buffer{
+public:
+    history_buffer() : head(0), mask(0) {}
+
+    // Room for the newest length + 1 outcomes, all not-taken
+    void resize(size_t length){
+        size_t size = 1;
+        while(size < length + 1){
+            size <<= 1;
+        }
+        bits.assign(size, 0);
+        mask = size - 1;
+        head = 0;
+    }
+
+    void push(bool taken){
+        head = (head + 1) & mask;
+        bits[head] = taken;
+    }
+
+    // Outcome i branches ago (0 is the newest)
+    bool operator[](size_t i) const {
+        return bits[(head - i) & mask];
+    }
+
+    std::vector<uint8_t>& data() { return bits; }
+    size_t& position() { return head; }
+
+private:
+    std::vector<uint8_t>    bits;
+    size_t                  head;       // position of the newest outcome
+    size_t                  mask;
+};
+
+struct folded_history{
+    uint32_t value;
+    uint32_t width;         // W, bits of the folded value
+    uint32_t mask;          // 2^W - 1
+    uint32_t outpoint;      // 1 << (L mod W), where the bit leaving the window lands
+
+    void init(uint32_t length, uint32_t width){
+        this->value = 0;
+        this->width = width;
+        this->mask = (1U << width) - 1;
+        this->outpoint = 1U << (length % width);
+    }
+
+    // newest is the outcome just pushed, oldest the one that left the window (history[L] after the push)
+    void update(bool newest, bool oldest){
+        value = (value << 1) | newest;
+        value ^= outpoint & (0 - (uint32_t)oldest);
+        value ^= value >> width;
+        value &= mask;
+    }
+};
+
+#endif
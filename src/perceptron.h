@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifndef PERCEPTRON_H
+#define PERCEPTRON_H
+
+/*  Perceptron predictor ("sim perceptron M1 N")
+
+    2^M1 perceptrons, selected by a hash of the PC, each with a bias weight and one weight per bit of the
+    N-bit global history (Jimenez and Lin). The prediction is taken if
+        y = bias + sum over i of w[i] * h[i] >= 0,     h[i] = +1 if the i-th newest branch was taken, else -1
+    and the perceptron is trained (w[i] += t * h[i], t = +1 taken / -1 not-taken) on a misprediction or
+    whenever |y| <= theta = 1.93 N + 14.
+
+    Weights are int8 (saturating at +/-127), stored in rows padded to PERCEPTRON_LANES bytes so the dot
+    product and the training update each run as whole 32-byte AVX2 (or 16-byte SSE4.1) vectors. The history
+    is kept as +1/-1 bytes in a buffer of twice its length where every outcome is written twice, so the newest
+    N outcomes are always one contiguous, directly loadable run. The instruction set is picked once at
+    startup; the scalar fallback gives identical results on any machine.
+*/
+#define PERCEPTRON_LANES        32
+#define PERCEPTRON_MAX_WEIGHT   127
+
+enum perceptron_simd{
+    PERCEPTRON_SCALAR,
+    PERCEPTRON_SSE41,
+    PERCEPTRON_AVX2
+};
+
+class perceptron_predictor{
+public:
+    perceptron_predictor() : index_mask(0), length(0), stride(0), theta(0), head(0), simd(PERCEPTRON_SCALAR) {}
+
+    // Whether init accepts the parameters
+    static bool valid_params(unsigned long int index_bits, unsigned long int history_length){
+        return index_bits <= 24 && history_length >= 1 && history_length <= 4096;
+    }
+
+    void init(unsigned long int index_bits, unsigned long int history_length){
+        if(!valid_params(index_bits, history_length)){
+            printf("Error: Invalid perceptron parameters M1=%lu N=%lu (M1 <= 24, 1 <= N <= 4096)\n", index_bits, history_length);
+            exit(EXIT_FAILURE);
+        }
+        index_mask = (1UL << index_bits) - 1;
+        length = history_length;
+        stride = (length + PERCEPTRON_LANES - 1) / PERCEPTRON_LANES * PERCEPTRON_LANES;
+        theta = (int)(1.93 * length + 14);
+        weights.assign((index_mask + 1) * stride, 0);
+        bias.assign(index_mask + 1, 0);
+
+        // Two copies of the history plus room for the padding lanes; lane_mask zeroes the lanes past N
+        history.assign(2 * length + stride, -1);
+        head = 0;
+        lane_mask.assign(stride, 0);
+        memset(&lane_mask[0], 0xff, length);
+
+        simd = PERCEPTRON_SCALAR;
+#if defined(__x86_64__) || defined(__i386__)
+        if(__builtin_cpu_supports("avx2")){
+            simd = PERCEPTRON_AVX2;
+        } else if(__builtin_cpu_supports("sse4.1")){
+            simd = PERCEPTRON_SSE41;
+        }
+#endif
+    }
+
+    // Predict the branch at addr, then train on its actual outcome. Returns the prediction.
+    bool step(uint64_t addr, bool taken){
+        // Step 1: Compute the output of the branch's perceptron and predict
+        size_t row;
+        int y = output(addr, &row);
+        int8_t* w = &weights[row * stride];
+        const int8_t* h = &history[head];
+        bool prediction = y >= 0;
+
+        // Step 2: Train on a misprediction or a low-confidence output
+        if(prediction != taken || (y <= theta && y >= -theta)){
+            int t = taken ? 1 : -1;
+            bias[row] = clamp(bias[row] + t);
+#if defined(__x86_64__) || defined(__i386__)
+            if(simd == PERCEPTRON_AVX2){
+                train_avx2(w, h, taken);
+            } else if(simd == PERCEPTRON_SSE41){
+                train_sse41(w, h, taken);
+            } else
+#endif
+            {
+                train_scalar(w, h, taken);
+            }
+        }
+
+        // Step 3: Shift the outcome into the history (the newest outcome is at head, in both copies)
+        head = (head == 0) ? length - 1 : head - 1;
+        history[head] = history[head + length] = taken ? 1 : -1;
+        return prediction;
+    }
+
+    // The prediction step() would make, without changing any state
+    bool predict(uint64_t addr) const {
+        size_t row;
+        return output(addr, &row) >= 0;
+    }
+
+    perceptron_simd instruction_set() const { return simd; }
+    void set_instruction_set(perceptron_simd simd) { this->simd = simd; }
+
+    // Raw state, for snapshots: the weights, the bias weights, then the history
+    void write(FILE* FP){
+        fwrite(&weights[0], 1, weights.size(), FP);
+        fwrite(&bias[0], 1, bias.size(), FP);
+        fwrite(&history[0], 1, history.size(), FP);
+        fwrite(&head, sizeof(head), 1, FP);
+    }
+
+    bool read(FILE* FP){
+        return fread(&weights[0], 1, weights.size(), FP) == weights.size() &&
+               fread(&bias[0], 1, bias.size(), FP) == bias.size() &&
+               fread(&history[0], 1, history.size(), FP) == history.size() &&
+               fread(&head, sizeof(head), 1, FP) == 1 && head < length;
+    }
+
+private:
+    // Select the perceptron of the branch at addr (its row) and compute its output over the newest N outcomes
+    int output(uint64_t addr, size_t* row) const {
+        uint64_t pc = addr >> 2;
+        *row = (pc ^ (pc >> 16)) & index_mask;
+        const int8_t* w = &weights[*row * stride];
+        const int8_t* h = &history[head];
+
+        int y = bias[*row];
+#if defined(__x86_64__) || defined(__i386__)
+        if(simd == PERCEPTRON_AVX2){
+            return y + dot_avx2(w, h);
+        } else if(simd == PERCEPTRON_SSE41){
+            return y + dot_sse41(w, h);
+        }
+#endif
+        return y + dot_scalar(w, h);
+    }
+
+    static int8_t clamp(int value){
+        return (int8_t)(value > PERCEPTRON_MAX_WEIGHT ? PERCEPTRON_MAX_WEIGHT : (value < -PERCEPTRON_MAX_WEIGHT ? -PERCEPTRON_MAX_WEIGHT : value));
+    }
+
+    int dot_scalar(const int8_t* w, const int8_t* h) const {
+        int sum = 0;
+        for(size_t i = 0; i < length; i++){
+            sum += w[i] * h[i];
+        }
+        return sum;
+    }
+
+    void train_scalar(int8_t* w, const int8_t* h, bool taken){
+        for(size_t i = 0; i < length; i++){
+            w[i] = clamp(w[i] + (taken ? h[i] : -h[i]));
+        }
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    // Padding lanes hold zero weights and see a zero history, so they add nothing and are never trained
+    __attribute__((target("avx2")))
+    int dot_avx2(const int8_t* w, const int8_t* h) const {
+        const __m256i ones8 = _mm256_set1_epi8(1);
+        const __m256i ones16 = _mm256_set1_epi16(1);
+        __m256i sum = _mm256_setzero_si256();
+        for(size_t i = 0; i < stride; i += 32){
+            __m256i hv = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(h + i)), _mm256_loadu_si256((const __m256i*)&lane_mask[i]));
+            __m256i product = _mm256_sign_epi8(_mm256_loadu_si256((const __m256i*)(w + i)), hv);        // w[i] * h[i]
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(ones8, product), ones16));
+        }
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+        return _mm_cvtsi128_si32(s);
+    }
+
+    __attribute__((target("avx2")))
+    void train_avx2(int8_t* w, const int8_t* h, bool taken){
+        const __m256i t = _mm256_set1_epi8(taken ? 1 : -1);
+        const __m256i min = _mm256_set1_epi8(-PERCEPTRON_MAX_WEIGHT);
+        for(size_t i = 0; i < stride; i += 32){
+            __m256i hv = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(h + i)), _mm256_loadu_si256((const __m256i*)&lane_mask[i]));
+            __m256i wv = _mm256_adds_epi8(_mm256_loadu_si256((const __m256i*)(w + i)), _mm256_sign_epi8(hv, t));
+            _mm256_storeu_si256((__m256i*)(w + i), _mm256_max_epi8(wv, min));
+        }
+    }
+
+    __attribute__((target("sse4.1")))
+    int dot_sse41(const int8_t* w, const int8_t* h) const {
+        const __m128i ones8 = _mm_set1_epi8(1);
+        const __m128i ones16 = _mm_set1_epi16(1);
+        __m128i sum = _mm_setzero_si128();
+        for(size_t i = 0; i < stride; i += 16){
+            __m128i hv = _mm_and_si128(_mm_loadu_si128((const __m128i*)(h + i)), _mm_loadu_si128((const __m128i*)&lane_mask[i]));
+            __m128i product = _mm_sign_epi8(_mm_loadu_si128((const __m128i*)(w + i)), hv);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_maddubs_epi16(ones8, product), ones16));
+        }
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+        return _mm_cvtsi128_si32(sum);
+    }
+
+    __attribute__((target("sse4.1")))
+    void train_sse41(int8_t* w, const int8_t* h, bool taken){
+        const __m128i t = _mm_set1_epi8(taken ? 1 : -1);
+        const __m128i min = _mm_set1_epi8(-PERCEPTRON_MAX_WEIGHT);
+        for(size_t i = 0; i < stride; i += 16){
+            __m128i hv = _mm_and_si128(_mm_loadu_si128((const __m128i*)(h + i)), _mm_loadu_si128((const __m128i*)&lane_mask[i]));
+            __m128i wv = _mm_adds_epi8(_mm_loadu_si128((const __m128i*)(w + i)), _mm_sign_epi8(hv, t));
+            _mm_storeu_si128((__m128i*)(w + i), _mm_max_epi8(wv, min));
+        }
+    }
+#endif
+
+    unsigned long int       index_mask;
+    size_t                  length;             // N
+    size_t                  stride;             // N rounded up to PERCEPTRON_LANES
+    int                     theta;              // training threshold
+    std::vector<int8_t>     weights;            // row r is weights[r * stride ...]
+    std::vector<int8_t>     bias;
+    std::vector<int8_t>     history;            // +1/-1 per outcome; history[head + i] is the i-th newest
+    std::vector<int8_t>     lane_mask;          // -1 for the first N lanes of a row, 0 for the padding
+    size_t                  head;
+    perceptron_simd         simd;
+};
+
+#endif
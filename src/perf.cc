@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "perf.h"
+
+// Open one user-space counter for thread tid; -1 (with errno set) if the event is not available
+static int open_event(int event, long tid){
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    if(event == PERF_EVENT_TASK_CLOCK){
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_TASK_CLOCK;
+    } else if(event == PERF_EVENT_CYCLES){
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    } else if(event == PERF_EVENT_INSTRUCTIONS){
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    } else if(event == PERF_EVENT_LLC_MISSES){
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    } else {
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+    }
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, (pid_t)tid, -1, -1, 0);
+#else
+    (void)event;
+    (void)tid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Explain why perf_event_open failed with error
+static void print_unavailable(const char* what, int error){
+    const char* hint = "";
+    if(error == EACCES || error == EPERM){
+        hint = "; see /proc/sys/kernel/perf_event_paranoid";
+    } else if(error == ENOENT || error == ENODEV || error == EOPNOTSUPP){
+        hint = "; this CPU or VM exposes no hardware counters";
+    }
+    printf("%s (perf_event_open: %s)%s\n", what, strerror(error), hint);
+}
+
+PerfCounters::PerfCounters(){
+    for(int e = 0; e < PERF_NUM_EVENTS; e++){
+        fds[e] = -1;
+    }
+    first_error = 0;
+}
+
+PerfCounters::~PerfCounters(){
+    for(int e = 0; e < PERF_NUM_EVENTS; e++){
+        if(fds[e] >= 0){
+            close(fds[e]);
+        }
+    }
+}
+
+void PerfCounters::open(long tid){
+    for(int e = 0; e < PERF_NUM_EVENTS; e++){
+        fds[e] = open_event(e, tid);
+        if(fds[e] < 0 && first_error == 0){
+            first_error = errno;
+        }
+    }
+}
+
+void PerfCounters::read(uint64_t values[PERF_NUM_EVENTS]) const {
+    for(int e = 0; e < PERF_NUM_EVENTS; e++){
+        uint64_t data[3];       // value, time enabled, time running
+        values[e] = 0;
+        if(fds[e] >= 0 && ::read(fds[e], data, sizeof(data)) == (ssize_t)sizeof(data) && data[2] != 0){
+            values[e] = (data[2] < data[1]) ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+        }
+    }
+}
+
+StageProfiler::StageProfiler(){
+    self.open(0);
+    other = NULL;
+    other_stage = PERF_STAGE_INPUT;
+    current = -1;
+    memset(totals, 0, sizeof(totals));
+    for(int s = 0; s < PERF_NUM_STAGES; s++){
+        seconds[s] = 0;
+    }
+}
+
+StageProfiler::~StageProfiler(){
+    delete other;
+}
+
+void StageProfiler::watch_thread(long tid, perf_stage stage){
+    delete other;
+    other = new PerfCounters;
+    other->open(tid);
+    other_stage = stage;
+    other->read(other_start);
+}
+
+void StageProfiler::enter(perf_stage stage){
+    stop();
+    current = stage;
+    self.read(last);
+    last_time = std::chrono::steady_clock::now();
+}
+
+void StageProfiler::stop(){
+    if(current < 0){
+        return;
+    }
+    uint64_t now[PERF_NUM_EVENTS];
+    self.read(now);
+    seconds[current] += std::chrono::duration<double>(std::chrono::steady_clock::now() - last_time).count();
+    for(int e = 0; e < PERF_NUM_EVENTS; e++){
+        totals[current][e] += now[e] - last[e];
+    }
+    current = -1;
+}
+
+void StageProfiler::print() const {
+    static const char* names[PERF_NUM_STAGES] = {"input", "predict", "output"};
+
+    uint64_t counts[PERF_NUM_STAGES][PERF_NUM_EVENTS];
+    memcpy(counts, totals, sizeof(counts));
+    uint64_t other_now[PERF_NUM_EVENTS];
+    if(other != NULL){
+        other->read(other_now);
+        for(int e = 0; e < PERF_NUM_EVENTS; e++){
+            counts[other_stage][e] += other_now[e] - other_start[e];
+        }
+    }
+
+    bool shown[PERF_NUM_EVENTS];
+    for(int e = 0; e < PERF_NUM_EVENTS; e++){
+        shown[e] = self.available(e);
+    }
+
+    printf("PERF\n");
+    printf("%-8s %10s %10s %16s %16s %6s %14s %14s\n", "stage", "seconds", "cpu sec", "cycles", "instructions", "IPC",
+           "LLC misses", "branch misses");
+    for(int s = 0; s < PERF_NUM_STAGES; s++){
+        const uint64_t* c = counts[s];
+        char cells[PERF_NUM_EVENTS + 1][32];
+        for(int e = 0; e < PERF_NUM_EVENTS; e++){
+            if(!shown[e]){
+                snprintf(cells[e], sizeof(cells[e]), "-");
+            } else if(e == PERF_EVENT_TASK_CLOCK){
+                snprintf(cells[e], sizeof(cells[e]), "%.3f", c[e] / 1e9);
+            } else {
+                snprintf(cells[e], sizeof(cells[e]), "%llu", (unsigned long long)c[e]);
+            }
+        }
+        char* ipc = cells[PERF_NUM_EVENTS];
+        if(shown[PERF_EVENT_CYCLES] && shown[PERF_EVENT_INSTRUCTIONS] && c[PERF_EVENT_CYCLES] != 0){
+            snprintf(ipc, sizeof(cells[0]), "%.2f", (double)c[PERF_EVENT_INSTRUCTIONS] / c[PERF_EVENT_CYCLES]);
+        } else {
+            snprintf(ipc, sizeof(cells[0]), "-");
+        }
+        printf("%-8s %10.3f %10s %16s %16s %6s %14s %14s\n", names[s], seconds[s], cells[PERF_EVENT_TASK_CLOCK],
+               cells[PERF_EVENT_CYCLES], cells[PERF_EVENT_INSTRUCTIONS], ipc, cells[PERF_EVENT_LLC_MISSES],
+               cells[PERF_EVENT_BRANCH_MISSES]);
+    }
+    if(self.error() != 0){
+        print_unavailable("some counters are unavailable", self.error());
+    }
+
+    // The other thread's counts are only added where it has the event; say so if it lacks any that
+    // the calling thread has, so an input stage missing the parser's share is not read at face value
+    if(other != NULL && other->error() != 0){
+        for(int e = 0; e < PERF_NUM_EVENTS; e++){
+            if(shown[e] && !other->available(e)){
+                print_unavailable("some parser thread counters are unavailable and left out of the input stage",
+                                  other->error());
+                break;
+            }
+        }
+    }
+}
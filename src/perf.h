@@ -0,0 +1,98 @@
+#include <stdint.h>
+#include <chrono>
+#ifndef PERF_H
+#define PERF_H
+
+/*  Hot-path self-profiling (--perf)
+
+    Reads the Linux perf counters of the simulator itself through perf_event_open: CPU time (task clock),
+    cycles, instructions, last-level cache misses and branch misses, all in user space only. The counts are
+    attributed to the stage the thread was in when they happened:
+
+        input       reading and parsing the trace, including waiting on the parser thread and, for text
+                    traces, everything the parser thread itself does (it is held until its counters are open)
+        predict     predicting and updating (the kernel's step)
+        output      print_contents
+
+    With --perf the trace loop alternates between reading PERF_BATCH_SIZE branches and running them, and
+    the counters are read at every switch, so the instrumentation costs two reads per batch. Events the
+    kernel or the machine does not provide (e.g. hardware counters in a VM, or perf_event_paranoid above
+    2) are printed as "-"; the wall clock time of each stage is always printed.
+*/
+#define PERF_BATCH_SIZE     (1 << 16)
+
+enum perf_stage{
+    PERF_STAGE_INPUT,
+    PERF_STAGE_PREDICT,
+    PERF_STAGE_OUTPUT,
+    PERF_NUM_STAGES
+};
+
+enum perf_event{
+    PERF_EVENT_TASK_CLOCK,          // nanoseconds on a CPU
+    PERF_EVENT_CYCLES,
+    PERF_EVENT_INSTRUCTIONS,
+    PERF_EVENT_LLC_MISSES,
+    PERF_EVENT_BRANCH_MISSES,
+    PERF_NUM_EVENTS
+};
+
+// The counters of one thread
+class PerfCounters{
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    // Open every event for thread tid (0 for the calling thread). Events that cannot be opened stay unavailable.
+    void open(long tid);
+
+    bool available(int event) const { return fds[event] >= 0; }
+    int error() const { return first_error; }   // errno of the first event that could not be opened, or 0
+
+    // Current counts, scaled up if the kernel had to multiplex the counters; 0 for unavailable events
+    void read(uint64_t values[PERF_NUM_EVENTS]) const;
+
+private:
+    int     fds[PERF_NUM_EVENTS];
+    int     first_error;
+
+    PerfCounters(const PerfCounters&);
+    PerfCounters& operator=(const PerfCounters&);
+};
+
+// Per-stage totals of the calling thread's counters, plus those of one other thread counted entirely
+// toward one stage
+class StageProfiler{
+public:
+    StageProfiler();
+    ~StageProfiler();
+
+    // Count everything thread tid does from now on toward stage. If some of its events cannot be opened,
+    // print() reports it under the table.
+    void watch_thread(long tid, perf_stage stage);
+
+    // Close the current stage, if any, and start stage
+    void enter(perf_stage stage);
+    void stop();
+
+    // Print the PERF section: one line per stage
+    void print() const;
+
+private:
+    PerfCounters    self;
+    PerfCounters*   other;
+    perf_stage      other_stage;
+    uint64_t        other_start[PERF_NUM_EVENTS];
+
+    int             current;                        // stage being counted, -1 for none
+    uint64_t        last[PERF_NUM_EVENTS];          // counts when it was entered
+    std::chrono::steady_clock::time_point last_time;
+
+    uint64_t        totals[PERF_NUM_STAGES][PERF_NUM_EVENTS];
+    double          seconds[PERF_NUM_STAGES];
+
+    StageProfiler(const StageProfiler&);
+    StageProfiler& operator=(const StageProfiler&);
+};
+
+#endif
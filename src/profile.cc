@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include "profile.h"
+
+#define PROFILE_INITIAL_SLOTS   (1 << 12)
+
+BranchProfiler::BranchProfiler(uint64_t interval_length){
+    this->slots.assign(PROFILE_INITIAL_SLOTS, pc_counters());
+    this->used = 0;
+    this->shift = 64 - 12;
+    memset(&this->zero_pc, 0, sizeof(this->zero_pc));
+    this->interval_length = interval_length;
+    this->interval_branches = 0;
+    this->interval_mispredictions = 0;
+}
+
+size_t BranchProfiler::find(uint64_t pc) const {
+    size_t i = hash(pc);
+    while(slots[i].pc != pc){
+        i = (i + 1) & (slots.size() - 1);
+    }
+    return i;
+}
+
+// Double the table and rehash
+void BranchProfiler::grow(){
+    std::vector<pc_counters> old;
+    old.swap(slots);
+    slots.assign(old.size() * 2, pc_counters());
+    shift--;
+    for(size_t i = 0; i < old.size(); i++){
+        if(old[i].pc != 0){
+            size_t j = hash(old[i].pc);
+            while(slots[j].pc != 0){
+                j = (j + 1) & (slots.size() - 1);
+            }
+            slots[j] = old[i];
+        }
+    }
+}
+
+static double rate_of(uint64_t mispredictions, uint64_t predictions){
+    return predictions ? (double)mispredictions / predictions * 100 : 0;
+}
+
+void BranchProfiler::write(const char* profile_file, size_t top_n) const {
+    // Rank the static branches by their number of mispredictions
+    std::vector<pc_counters> branches;
+    for(size_t i = 0; i < slots.size(); i++){
+        if(slots[i].pc != 0){
+            branches.push_back(slots[i]);
+        }
+    }
+    if(zero_pc.predictions != 0){
+        branches.push_back(zero_pc);
+    }
+    std::sort(branches.begin(), branches.end(), [](const pc_counters& a, const pc_counters& b){
+        return a.mispredictions != b.mispredictions ? a.mispredictions > b.mispredictions : a.pc < b.pc;
+    });
+    if(branches.size() > top_n){
+        branches.resize(top_n);
+    }
+
+    // The interval in progress at the end of the trace is reported as a final, shorter interval
+    std::vector<uint64_t> lengths(intervals.size(), interval_length);
+    std::vector<uint64_t> counts(intervals);
+    if(interval_branches != 0){
+        lengths.push_back(interval_branches);
+        counts.push_back(interval_mispredictions);
+    }
+
+    std::string name(profile_file);
+    bool json = name.size() > 5 && name.compare(name.size() - 5, 5, ".json") == 0;
+    std::string interval_file = name;
+    if(!json){
+        if(interval_file.size() > 4 && interval_file.compare(interval_file.size() - 4, 4, ".csv") == 0){
+            interval_file.resize(interval_file.size() - 4);
+        }
+        interval_file += "_intervals.csv";
+    }
+
+    FILE* FP = fopen(profile_file, "w");
+    if(FP == NULL){
+        printf("Error: Unable to open file %s\n", profile_file);
+        exit(EXIT_FAILURE);
+    }
+
+    if(json){
+        fprintf(FP, "{\n  \"interval_length\": %llu,\n  \"top_branches\": [", (unsigned long long)interval_length);
+        for(size_t i = 0; i < branches.size(); i++){
+            fprintf(FP, "%s\n    {\"pc\": \"%llx\", \"predictions\": %llu, \"mispredictions\": %llu, \"misprediction_rate\": %.2f}",
+                    i ? "," : "", (unsigned long long)branches[i].pc, (unsigned long long)branches[i].predictions,
+                    (unsigned long long)branches[i].mispredictions, rate_of(branches[i].mispredictions, branches[i].predictions));
+        }
+        fprintf(FP, "\n  ],\n  \"intervals\": [");
+        uint64_t start = 0;
+        for(size_t i = 0; i < counts.size(); i++){
+            fprintf(FP, "%s\n    {\"start\": %llu, \"branches\": %llu, \"mispredictions\": %llu, \"misprediction_rate\": %.2f}",
+                    i ? "," : "", (unsigned long long)start, (unsigned long long)lengths[i], (unsigned long long)counts[i],
+                    rate_of(counts[i], lengths[i]));
+            start += lengths[i];
+        }
+        fprintf(FP, "\n  ]\n}\n");
+    } else {
+        fprintf(FP, "rank,pc,predictions,mispredictions,misprediction_rate\n");
+        for(size_t i = 0; i < branches.size(); i++){
+            fprintf(FP, "%lu,%llx,%llu,%llu,%.2f\n", (unsigned long)i + 1, (unsigned long long)branches[i].pc,
+                    (unsigned long long)branches[i].predictions, (unsigned long long)branches[i].mispredictions,
+                    rate_of(branches[i].mispredictions, branches[i].predictions));
+        }
+    }
+    if(fclose(FP) != 0){
+        printf("Error: Unable to write file %s\n", profile_file);
+        exit(EXIT_FAILURE);
+    }
+    if(json){
+        return;
+    }
+
+    FP = fopen(interval_file.c_str(), "w");
+    if(FP == NULL){
+        printf("Error: Unable to open file %s\n", interval_file.c_str());
+        exit(EXIT_FAILURE);
+    }
+    fprintf(FP, "interval,start,branches,mispredictions,misprediction_rate\n");
+    uint64_t start = 0;
+    for(size_t i = 0; i < counts.size(); i++){
+        fprintf(FP, "%lu,%llu,%llu,%llu,%.2f\n", (unsigned long)i, (unsigned long long)start, (unsigned long long)lengths[i],
+                (unsigned long long)counts[i], rate_of(counts[i], lengths[i]));
+        start += lengths[i];
+    }
+    if(fclose(FP) != 0){
+        printf("Error: Unable to write file %s\n", interval_file.c_str());
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,78 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/*  Per-branch profiling (--profile)
+
+    Records, for every simulated branch, its static branch (PC) and whether it was mispredicted:
+      - per-PC prediction and misprediction counts, in an open-addressing hash table keyed by PC
+      - the number of mispredictions in each consecutive interval of interval_length branches
+    The kernels take the profiler as a policy (see null_profiler in sim_bp.h), so runs without
+    --profile compile the recording out of the trace loop entirely.
+*/
+class BranchProfiler{
+public:
+    explicit BranchProfiler(uint64_t interval_length);
+
+    void record(uint64_t addr, bool mispredicted){
+        // Per-PC counters: linear probing, PC 0 marks an empty slot (PC 0 itself gets the spare slot)
+        if(addr == 0){
+            zero_pc.predictions++;
+            zero_pc.mispredictions += mispredicted;
+        } else {
+            size_t i = hash(addr);
+            while(slots[i].pc != addr && slots[i].pc != 0){
+                i = (i + 1) & (slots.size() - 1);
+            }
+            if(slots[i].pc == 0){
+                slots[i].pc = addr;
+                if(++used * 2 > slots.size()){
+                    grow();
+                    i = find(addr);
+                }
+            }
+            slots[i].predictions++;
+            slots[i].mispredictions += mispredicted;
+        }
+
+        // Interval counters
+        interval_mispredictions += mispredicted;
+        if(++interval_branches == interval_length){
+            intervals.push_back(interval_mispredictions);
+            interval_branches = 0;
+            interval_mispredictions = 0;
+        }
+    }
+
+    // Write the top_n branches with the most mispredictions and the interval time series. A file name
+    // ending in .json gets one JSON document; otherwise both are written as CSV, the intervals to
+    // <profile_file without .csv>_intervals.csv.
+    void write(const char* profile_file, size_t top_n) const;
+
+private:
+    typedef struct pc_counters{
+        uint64_t pc;
+        uint64_t predictions;
+        uint64_t mispredictions;
+    }pc_counters;
+
+    size_t hash(uint64_t pc) const {
+        return (size_t)(((pc >> 2) * 0x9e3779b97f4a7c15ULL) >> shift);
+    }
+    size_t find(uint64_t pc) const;
+    void grow();
+
+    std::vector<pc_counters>    slots;
+    size_t                      used;
+    unsigned int                shift;          // 64 - log2(slots.size())
+    pc_counters                 zero_pc;
+
+    uint64_t                    interval_length;
+    uint64_t                    interval_branches;
+    uint64_t                    interval_mispredictions;
+    std::vector<uint64_t>       intervals;      // mispredictions in each complete interval
+};
+
+#endif
@@ -1,7 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
 #include "sim_bp.h"
+#include "trace.h"
+#include "sweep.h"
+#include "batch.h"
+#include "profile.h"
+#include "cache.h"
+#include "explore.h"
+#include "perf.h"
 
 /*  argc holds the number of command line arguments
     argv[] holds the commands themselves
@@ -13,15 +25,540 @@
     argv[1] = "bimodal"
     argv[2] = "6"
     ... and so on
+
+    sim convert gcc_trace.txt gcc_trace.bpt
+    converts a text trace into the binary trace format (see trace.h). Binary traces can be given
+    anywhere a trace file is expected and are memory-mapped instead of parsed.
+
+    sim sweep gcc_trace.txt gshare.csv gshare:7-20:0-20 bimodal:7-20
+    simulates every listed configuration in a single pass over the trace (see sweep.h)
+
+    sim batch jobs.manifest results.csv
+    runs every (trace, configuration) job of the manifest on a work-stealing pool of all cores (see batch.h)
+
+    sim explore gcc_trace.bpt frontier.csv 65536 gshare
+    searches the gshare configurations of at most 65536 bits for the Pareto frontier of misprediction rate
+    versus storage, dropping losing configurations early (see explore.h)
+
+    Simulation runs also take the options in sim_options, anywhere on the command line, e.g.
+    sim gshare 9 3 gcc_trace.txt --checkpoint gshare.snap 100000000
+    sim gshare 9 3 gcc_trace.bpt --sample 10000 1000000 --sample-warmup 100000
+    sim hybrid 8 14 10 5 gcc_trace.txt --profile hybrid.json --profile-top 50 --profile-interval 10000
+    sim gshare 20 12 gcc_trace.bpt --dump binary --dump-file gshare.tables
+    sim tage 7 10 200 12 gcc_trace.bpt --parallel 16 --parallel-warmup 1000000 --parallel-verify
+    sim gshare 32 32 gcc_trace.bpt --sparse --dump sparse
+    sim gshare 9 3 gcc_trace.txt --cache sim_cache
+    sim gshare 20 12 gcc_trace.txt --perf
+
+    sweep and batch take --cache too:
+    sim sweep gcc_trace.txt gshare.csv gshare:7-20:0-20 --cache sim_cache
+
+    sim tage 7 10 200 12 gcc_trace.txt
+    TAGE with K = 7 tagged tables of 2^M1 entries, history lengths growing geometrically up to N, and a 2^M2
+    entry bimodal base predictor (see tage.h)
+
+    sim perceptron 10 64 gcc_trace.txt
+    2^M1 perceptrons with weights over N = 64 bits of global history (see perceptron.h)
+*/
+
+// Options of a simulation run
+typedef struct sim_options{
+    const char*         save_snapshot;          // --save-snapshot FILE: save the predictor state at the end of the run
+    const char*         checkpoint;             // --checkpoint FILE INTERVAL: save the predictor state every INTERVAL branches
+    unsigned long int   checkpoint_interval;
+    const char*         restore;                // --restore FILE: resume a run from a snapshot (state, counters and trace offset)
+    const char*         warm_start;             // --warm-start FILE: start the run from the predictor state in a snapshot
+    unsigned long int   sample_unit;            // --sample UNIT PERIOD: measure UNIT branches out of every PERIOD,
+    unsigned long int   sample_period;          //   functionally warming the predictor with the rest
+    unsigned long int   sample_warmup;          // --sample-warmup W: fast-forward instead, warming only W branches before each unit
+    const char*         profile;                // --profile FILE: write per-branch and per-interval misprediction counts (see profile.h)
+    unsigned long int   profile_top;            // --profile-top N: number of branches listed in the profile (default 20)
+    unsigned long int   profile_interval;       // --profile-interval N: branches per interval of the profile time series (default 100000)
+    dump_mode           dump;                   // --dump text|binary|sparse|stats: how the final table contents are printed (default text)
+    const char*         dump_file;              // --dump-file FILE: where --dump binary writes the tables
+    unsigned long int   parallel;               // --parallel C: simulate C chunks of a binary trace concurrently (approximate)
+    unsigned long int   parallel_warmup;        // --parallel-warmup W: branches replayed before each chunk (default 100000)
+    bool                parallel_verify;        // --parallel-verify: also run exactly and report the deviation
+    bool                sparse;                 // --sparse: allocate the counter tables page by page on first touch
+    const char*         cache;                  // --cache DIR: reuse the results of identical runs (see cache.h)
+    bool                perf;                   // --perf: report perf counters per stage of the run (see perf.h)
+    int                 num_options;            // number of options given
+}sim_options;
+
+// Remove the options from argv, leaving only the positional arguments
+static void parse_options(int* argc, char* argv[], sim_options* options)
+{
+    int positional = 1;
+
+    memset(options, 0, sizeof(*options));
+    options->profile_top = 20;
+    options->profile_interval = 100000;
+    options->dump = DUMP_TEXT;
+    options->parallel_warmup = 100000;
+    for(int i = 1; i < *argc; i++)
+    {
+        if(strncmp(argv[i], "--", 2) != 0)
+        {
+            argv[positional++] = argv[i];
+            continue;
+        }
+
+        int values = 1;
+        if(strcmp(argv[i], "--checkpoint") == 0 || strcmp(argv[i], "--sample") == 0)
+        {
+            values = 2;
+        }
+        else if(strcmp(argv[i], "--parallel-verify") == 0 || strcmp(argv[i], "--sparse") == 0 || strcmp(argv[i], "--perf") == 0)
+        {
+            values = 0;
+        }
+        else if(strcmp(argv[i], "--save-snapshot") != 0 && strcmp(argv[i], "--restore") != 0 && strcmp(argv[i], "--warm-start") != 0 &&
+                strcmp(argv[i], "--sample-warmup") != 0 && strcmp(argv[i], "--profile") != 0 && strcmp(argv[i], "--profile-top") != 0 &&
+                strcmp(argv[i], "--profile-interval") != 0 && strcmp(argv[i], "--dump") != 0 && strcmp(argv[i], "--dump-file") != 0 &&
+                strcmp(argv[i], "--parallel") != 0 && strcmp(argv[i], "--parallel-warmup") != 0 && strcmp(argv[i], "--cache") != 0)
+        {
+            printf("Error: Unknown option %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        if(i + values >= *argc)
+        {
+            printf("Error: %s wrong number of inputs\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        options->num_options++;
+
+        if(strcmp(argv[i], "--save-snapshot") == 0)
+        {
+            options->save_snapshot = argv[i + 1];
+        }
+        else if(strcmp(argv[i], "--checkpoint") == 0)
+        {
+            options->checkpoint = argv[i + 1];
+            options->checkpoint_interval = strtoul(argv[i + 2], NULL, 10);
+            if(options->checkpoint_interval == 0)
+            {
+                printf("Error: Invalid checkpoint interval %s\n", argv[i + 2]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if(strcmp(argv[i], "--restore") == 0)
+        {
+            options->restore = argv[i + 1];
+        }
+        else if(strcmp(argv[i], "--warm-start") == 0)
+        {
+            options->warm_start = argv[i + 1];
+        }
+        else if(strcmp(argv[i], "--sample") == 0)
+        {
+            options->sample_unit = strtoul(argv[i + 1], NULL, 10);
+            options->sample_period = strtoul(argv[i + 2], NULL, 10);
+            if(options->sample_unit == 0 || options->sample_period < options->sample_unit)
+            {
+                printf("Error: Invalid sampling unit %s / period %s\n", argv[i + 1], argv[i + 2]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if(strcmp(argv[i], "--sample-warmup") == 0)
+        {
+            options->sample_warmup = strtoul(argv[i + 1], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--profile") == 0)
+        {
+            options->profile = argv[i + 1];
+        }
+        else if(strcmp(argv[i], "--profile-top") == 0)
+        {
+            options->profile_top = strtoul(argv[i + 1], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--profile-interval") == 0)
+        {
+            options->profile_interval = strtoul(argv[i + 1], NULL, 10);
+            if(options->profile_interval == 0)
+            {
+                printf("Error: Invalid profile interval %s\n", argv[i + 1]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if(strcmp(argv[i], "--dump") == 0)
+        {
+            options->dump = get_dump_mode(argv[i + 1]);
+        }
+        else if(strcmp(argv[i], "--dump-file") == 0)
+        {
+            options->dump_file = argv[i + 1];
+        }
+        else if(strcmp(argv[i], "--parallel") == 0)
+        {
+            options->parallel = strtoul(argv[i + 1], NULL, 10);
+            if(options->parallel == 0)
+            {
+                printf("Error: Invalid number of chunks %s\n", argv[i + 1]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if(strcmp(argv[i], "--parallel-warmup") == 0)
+        {
+            options->parallel_warmup = strtoul(argv[i + 1], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--parallel-verify") == 0)
+        {
+            options->parallel_verify = true;
+        }
+        else if(strcmp(argv[i], "--sparse") == 0)
+        {
+            options->sparse = true;
+        }
+        else if(strcmp(argv[i], "--cache") == 0)
+        {
+            options->cache = argv[i + 1];
+        }
+        else if(strcmp(argv[i], "--perf") == 0)
+        {
+            options->perf = true;
+        }
+        i += values;
+    }
+    if(options->restore != NULL && options->warm_start != NULL)
+    {
+        printf("Error: --restore and --warm-start cannot be combined\n");
+        exit(EXIT_FAILURE);
+    }
+    if(options->sample_unit != 0 && (options->checkpoint != NULL || options->restore != NULL))
+    {
+        printf("Error: --sample cannot be combined with --checkpoint or --restore\n");
+        exit(EXIT_FAILURE);
+    }
+    if(options->sample_warmup > options->sample_period - options->sample_unit)
+    {
+        printf("Error: --sample-warmup needs --sample with at least %lu unmeasured branches per period\n", options->sample_warmup);
+        exit(EXIT_FAILURE);
+    }
+    if((options->dump == DUMP_BINARY) != (options->dump_file != NULL))
+    {
+        printf("Error: --dump binary and --dump-file must be given together\n");
+        exit(EXIT_FAILURE);
+    }
+    if(options->parallel != 0 && (options->checkpoint != NULL || options->restore != NULL || options->warm_start != NULL ||
+                                  options->save_snapshot != NULL || options->sample_unit != 0 || options->profile != NULL))
+    {
+        printf("Error: --parallel cannot be combined with snapshots, --sample or --profile\n");
+        exit(EXIT_FAILURE);
+    }
+    if(options->parallel_verify && options->parallel == 0)
+    {
+        printf("Error: --parallel-verify needs --parallel\n");
+        exit(EXIT_FAILURE);
+    }
+    if(options->cache != NULL && (options->checkpoint != NULL || options->restore != NULL || options->warm_start != NULL ||
+                                  options->sample_unit != 0 || options->profile != NULL || options->parallel != 0))
+    {
+        printf("Error: --cache cannot be combined with --checkpoint, --restore, --warm-start, --sample, --profile or --parallel\n");
+        exit(EXIT_FAILURE);
+    }
+    if(options->perf && (options->checkpoint != NULL || options->sample_unit != 0 || options->profile != NULL ||
+                         options->parallel != 0 || options->cache != NULL))
+    {
+        printf("Error: --perf cannot be combined with --checkpoint, --sample, --profile, --parallel or --cache\n");
+        exit(EXIT_FAILURE);
+    }
+    *argc = positional;
+}
+
+/*  SMARTS-style sampled simulation
+
+    The trace is cut into periods of sample_period branches. Only the last sample_unit branches of each
+    period are measured; the branches before them update the predictor state without any statistics
+    (functional warming). With sample_warmup, all but the last sample_warmup of those branches are skipped
+    outright, which is O(1) on binary traces. Returns the misprediction rate of every measured unit.
 */
+template<class Kernel>
+static std::vector<double> run_sampled(Kernel& kernel, BranchHistoryTable& BHT, TraceReader& trace, const sim_options& options)
+{
+    std::vector<double> unit_rates;
+    uint64_t unmeasured = options.sample_period - options.sample_unit;
+    uint64_t fast_forward = options.sample_warmup ? unmeasured - options.sample_warmup : 0;
+    uint64_t warmup = unmeasured - fast_forward;
+
+    auto step = [&](uint64_t addr, char outcome)
+    {
+        kernel.step(addr, outcome == 't');
+    };
+    auto warm = [&](uint64_t addr, char outcome)
+    {
+        kernel.warm(addr, outcome == 't');
+    };
+
+    while(true)
+    {
+        if(trace.skip(fast_forward) != fast_forward || trace.run(warmup, warm) != warmup)
+        {
+            break;
+        }
+
+        uint64_t mispredictions = BHT.number_of_mispredictions;
+        uint64_t measured = trace.run(options.sample_unit, step);
+        kernel.finish();
+        if(measured == 0)
+        {
+            break;
+        }
+        unit_rates.push_back((double)(BHT.number_of_mispredictions - mispredictions) / measured);
+        if(measured != options.sample_unit)
+        {
+            break;
+        }
+    }
+    return unit_rates;
+}
+
+// Print the sampled misprediction rate with its 95% confidence interval
+static void print_sampling(const BranchHistoryTable& BHT, const std::vector<double>& unit_rates, const sim_options& options)
+{
+    double n = unit_rates.size();
+    double mean = 0, variance = 0;
+    for(size_t i = 0; i < unit_rates.size(); i++)
+    {
+        mean += unit_rates[i] / n;
+    }
+    for(size_t i = 0; i < unit_rates.size(); i++)
+    {
+        variance += (unit_rates[i] - mean) * (unit_rates[i] - mean) / (n > 1 ? n - 1 : 1);
+    }
+    double rate = BHT.number_of_predictions ? (double)BHT.number_of_mispredictions / BHT.number_of_predictions : 0;
+
+    printf("SAMPLING\n");
+    printf("sampled units: %lu (%lu of every %lu branches, %s)\n", (unsigned long)unit_rates.size(), options.sample_unit,
+           options.sample_period, options.sample_warmup ? "fast-forwarded" : "functionally warmed");
+    printf("estimated misprediction rate: %.2f%% +/- %.2f%% (95%% confidence)\n", rate * 100, 1.96 * sqrt(variance / n) * 100);
+}
+
+// --perf: alternate between reading a batch of branches (input stage) and running it through the kernel
+// (predict stage), so that the counters can be read off at every switch
+template<class Kernel>
+static void run_instrumented(Kernel& kernel, TraceReader& trace, StageProfiler& stages)
+{
+    std::vector<uint64_t> addr(PERF_BATCH_SIZE);
+    std::vector<char> outcome(PERF_BATCH_SIZE);
+    size_t count;
+    do
+    {
+        stages.enter(PERF_STAGE_INPUT);
+        count = 0;
+        trace.run(PERF_BATCH_SIZE, [&](uint64_t a, char o)
+        {
+            addr[count] = a;
+            outcome[count] = o;
+            count++;
+        });
+        stages.enter(PERF_STAGE_PREDICT);
+        for(size_t i = 0; i < count; i++)
+        {
+            kernel.step(addr[i], outcome[i] == 't');
+        }
+    }while(count == PERF_BATCH_SIZE);
+}
+
+/*  Chunk-parallel simulation (approximate)
+
+    The binary trace is cut into options.parallel chunks of consecutive branches, which are simulated
+    concurrently, one thread each, by predictors that all start from the initial state. Every chunk but
+    the first first replays the parallel_warmup branches before it with statistics off, to approximate the
+    state an exact run would have reached there. The chunk counts are added into BHT, which simulates the
+    last chunk, so the table contents it prints are those at the end of the trace. Returns the
+    mispredictions of every chunk.
+*/
+static std::vector<uint64_t> run_parallel(BranchHistoryTable& BHT, const char* trace_file, uint64_t num_branches, const sim_options& options)
+{
+    size_t num_chunks = options.parallel;
+    std::vector<BranchHistoryTable*> chunks;
+    for(size_t c = 0; c + 1 < num_chunks; c++)
+    {
+        chunks.push_back(new BranchHistoryTable(BHT.bp_param, BHT.sparse));
+    }
+    chunks.push_back(&BHT);
+
+    std::vector<std::thread> workers;
+    for(size_t c = 0; c < num_chunks; c++)
+    {
+        workers.push_back(std::thread([&, c]()
+        {
+            uint64_t begin = num_branches * c / num_chunks;
+            uint64_t end = num_branches * (c + 1) / num_chunks;
+            uint64_t warmup = std::min<uint64_t>(begin, options.parallel_warmup);
+
+            TraceReader trace;
+            if(!trace.open(trace_file))
+            {
+                printf("Error: Unable to open file %s\n", trace_file);
+                exit(EXIT_FAILURE);
+            }
+            trace.skip(begin - warmup);
+            chunks[c]->with_kernel([&](auto& kernel)
+            {
+                trace.run(warmup, [&](uint64_t addr, char outcome)
+                {
+                    kernel.warm(addr, outcome == 't');
+                });
+                trace.run(end - begin, [&](uint64_t addr, char outcome)
+                {
+                    kernel.step(addr, outcome == 't');
+                });
+            });
+        }));
+    }
+    for(size_t c = 0; c < num_chunks; c++)
+    {
+        workers[c].join();
+    }
+
+    std::vector<uint64_t> chunk_mispredictions;
+    for(size_t c = 0; c < num_chunks; c++)
+    {
+        chunk_mispredictions.push_back(chunks[c]->number_of_mispredictions);
+    }
+    for(size_t c = 0; c + 1 < num_chunks; c++)
+    {
+        BHT.number_of_predictions += chunks[c]->number_of_predictions;
+        BHT.number_of_mispredictions += chunks[c]->number_of_mispredictions;
+        delete chunks[c];
+    }
+    return chunk_mispredictions;
+}
+
+// Print the chunk-parallel counts and, with --parallel-verify, how far they deviate from an exact run of
+// the same trace, per chunk and in total
+static void print_parallel(const BranchHistoryTable& BHT, const char* trace_file, uint64_t num_branches,
+                           const std::vector<uint64_t>& chunk_mispredictions, double seconds, const sim_options& options)
+{
+    size_t num_chunks = chunk_mispredictions.size();
+    double rate = BHT.number_of_predictions ? (double)BHT.number_of_mispredictions / BHT.number_of_predictions : 0;
+
+    printf("PARALLEL\n");
+    printf("chunks: %lu of about %llu branches, each warmed up with up to %lu branches\n", (unsigned long)num_chunks,
+           (unsigned long long)(num_branches / num_chunks), options.parallel_warmup);
+    printf("parallel misprediction rate: %.4f%% (%.2f s)\n", rate * 100, seconds);
+    if(!options.parallel_verify)
+    {
+        return;
+    }
+
+    // Exact run, stopping at every chunk boundary to read off the chunk's mispredictions
+    BranchHistoryTable exact(BHT.bp_param, BHT.sparse);
+    TraceReader trace;
+    if(!trace.open(trace_file))
+    {
+        printf("Error: Unable to open file %s\n", trace_file);
+        exit(EXIT_FAILURE);
+    }
+    std::vector<uint64_t> exact_mispredictions;
+    auto start = std::chrono::steady_clock::now();
+    exact.with_kernel([&](auto& kernel)
+    {
+        auto step = [&](uint64_t addr, char outcome)
+        {
+            kernel.step(addr, outcome == 't');
+        };
+        for(size_t c = 0; c < num_chunks; c++)
+        {
+            uint64_t before = exact.number_of_mispredictions;
+            trace.run(num_branches * (c + 1) / num_chunks - num_branches * c / num_chunks, step);
+            kernel.finish();
+            exact_mispredictions.push_back(exact.number_of_mispredictions - before);
+        }
+    });
+    double exact_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double exact_rate = exact.number_of_predictions ? (double)exact.number_of_mispredictions / exact.number_of_predictions : 0;
+
+    printf("exact misprediction rate: %.4f%% (%.2f s)\n", exact_rate * 100, exact_seconds);
+    for(size_t c = 0; c < num_chunks; c++)
+    {
+        printf("chunk %lu: exact %llu, parallel %llu mispredictions (%+lld)\n", (unsigned long)c, (unsigned long long)exact_mispredictions[c],
+               (unsigned long long)chunk_mispredictions[c], (long long)(chunk_mispredictions[c] - exact_mispredictions[c]));
+    }
+    int64_t deviation = (int64_t)(BHT.number_of_mispredictions - exact.number_of_mispredictions);
+    printf("deviation: %+lld mispredictions, %+.4f%% misprediction rate (%+.3f%% relative)\n", (long long)deviation, (rate - exact_rate) * 100,
+           exact.number_of_mispredictions ? 100.0 * deviation / exact.number_of_mispredictions : 0);
+}
+
 int main (int argc, char* argv[])
 {
-    FILE *FP;               // File handler
+    TraceReader trace;      // Trace reader (text or memory-mapped binary)
     char *trace_file;       // Variable that holds trace file name;
     bp_params params;       // look at sim_bp.h header file for the the definition of struct bp_params
-    char outcome;           // Variable holds branch outcome
-    unsigned long int addr; // Variable holds the address read from input file
+    sim_options options;    // Run options (snapshots, sampling)
     
+    // Parameters a predictor type does not use stay 0, so snapshots of the same configuration match
+    memset(&params, 0, sizeof(params));
+
+    if(argc > 1 && strcmp(argv[1], "convert") == 0)         // Text to binary trace conversion
+    {
+        if(argc != 4)
+        {
+            printf("Error: %s wrong number of inputs:%d\n", argv[1], argc-1);
+            exit(EXIT_FAILURE);
+        }
+        printf("COMMAND\n%s %s %s %s\n", argv[0], argv[1], argv[2], argv[3]);
+        uint64_t num_branches = convert_trace(argv[2], argv[3]);
+        printf("converted %llu branches\n", (unsigned long long)num_branches);
+        return 0;
+    }
+
+    parse_options(&argc, argv, &options);
+
+    // sweep and batch take no option other than --cache
+    if(argc > 1 && (strcmp(argv[1], "sweep") == 0 || strcmp(argv[1], "batch") == 0) &&
+       options.num_options != (options.cache != NULL ? 1 : 0))
+    {
+        printf("Error: %s only takes --cache\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(argc > 1 && strcmp(argv[1], "sweep") == 0)           // Multi-configuration sweep
+    {
+        if(argc < 5)
+        {
+            printf("Error: %s wrong number of inputs:%d\n", argv[1], argc-1);
+            exit(EXIT_FAILURE);
+        }
+        int num_configs = run_sweep(argv[2], argv[3], argc - 4, argv + 4, options.cache);
+        printf("swept %d configurations, results in %s\n", num_configs, argv[3]);
+        return 0;
+    }
+
+    if(argc > 1 && strcmp(argv[1], "explore") == 0)         // Design-space search
+    {
+        if(argc < 6 || options.num_options != 0)
+        {
+            printf("Error: %s wrong number of inputs:%d\n", argv[1], argc-1);
+            exit(EXIT_FAILURE);
+        }
+        char* end;
+        unsigned long long budget = strtoull(argv[4], &end, 10);
+        if(end == argv[4] || *end != '\0' || budget == 0)
+        {
+            printf("Error: Invalid storage budget %s\n", argv[4]);
+            exit(EXIT_FAILURE);
+        }
+        int num_configs = run_explore(argv[2], argv[3], budget, argc - 5, argv + 5);
+        printf("explored %d configurations, frontier in %s\n", num_configs, argv[3]);
+        return 0;
+    }
+
+    if(argc > 1 && strcmp(argv[1], "batch") == 0)           // Multi-trace batch
+    {
+        if(argc != 4)
+        {
+            printf("Error: %s wrong number of inputs:%d\n", argv[1], argc-1);
+            exit(EXIT_FAILURE);
+        }
+        int num_groups, num_concurrent;
+        int num_jobs = run_batch_manifest(argv[2], argv[3], options.cache, &num_groups, &num_concurrent);
+        printf("ran %d jobs (%d traces simulated, %d at once), results in %s\n", num_jobs, num_groups, num_concurrent,
+               argv[3]);
+        return 0;
+    }
+
     if (!(argc == 4 || argc == 5 || argc == 7))
     {
         printf("Error: Wrong number of inputs:%d\n", argc-1);
@@ -42,7 +579,7 @@ int main (int argc, char* argv[])
         trace_file      = argv[3];
         printf("COMMAND\n%s %s %lu %s\n", argv[0], params.bp_name, params.M2, trace_file);
     }
-    else if(strcmp(params.bp_name, "gshare") == 0)          // Gshare
+    else if(strcmp(params.bp_name, "gshare") == 0 || strcmp(params.bp_name, "perceptron") == 0)   // Gshare, perceptron
     {
         if(argc != 5)
         {
@@ -55,7 +592,7 @@ int main (int argc, char* argv[])
         printf("COMMAND\n%s %s %lu %lu %s\n", argv[0], params.bp_name, params.M1, params.N, trace_file);
 
     }
-    else if(strcmp(params.bp_name, "hybrid") == 0)          // Hybrid
+    else if(strcmp(params.bp_name, "hybrid") == 0 || strcmp(params.bp_name, "tage") == 0)     // Hybrid, TAGE
     {
         if(argc != 7)
         {
@@ -76,45 +613,160 @@ int main (int argc, char* argv[])
         exit(EXIT_FAILURE);
     }
     
-    // Open trace_file in read mode
-    FP = fopen(trace_file, "r");
-    if(FP == NULL)
+    // Initialize the branch history table
+    BranchHistoryTable BHT(params, options.sparse);
+    
+    // A cached result of the same trace and configuration is printed without simulating, or even opening
+    // the trace. The final tables are only needed (and only cached) when they are printed or saved.
+    ResultCache* cache = NULL;
+    bool cache_tables = (options.dump != DUMP_STATS || options.save_snapshot != NULL);
+    if(options.cache != NULL)
+    {
+        cache = new ResultCache(options.cache, trace_file);
+        if(cache->lookup(BHT, cache_tables))
+        {
+            if(options.save_snapshot != NULL)
+            {
+                BHT.save_snapshot(options.save_snapshot, BHT.number_of_predictions);
+            }
+            BHT.print_contents(options.dump, options.dump_file);
+            delete cache;
+            return 0;
+        }
+    }
+
+    // Open trace_file; binary traces are memory-mapped, anything else is read as text
+    if(!trace.open(trace_file, options.perf))
     {
         // Throw error and exit if fopen() failed
         printf("Error: Unable to open file %s\n", trace_file);
         exit(EXIT_FAILURE);
     }
 
-    // Initialize the branch history table
-    BranchHistoryTable BHT(params);
-    
-    char str[2];
-    while(fscanf(FP, "%lx %s", &addr, str) != EOF)
+    // Per-stage perf counters. The text parser thread only ever does input work; it is held until its
+    // counters are attached, so they see all of it.
+    StageProfiler* stages = NULL;
+    if(options.perf)
     {
-        
-        outcome = str[0];
-        // if (outcome == 't')
-        //     printf("%lx %s\n", addr, "t");           // Print and test if file is read correctly
-        // else if (outcome == 'n')
-        //     printf("%lx %s\n", addr, "n");          // Print and test if file is read correctly
-        /*************************************
-            Add branch predictor code here
-        **************************************/
+        stages = new StageProfiler;
+        if(trace.parser_thread_id() != 0)
+        {
+            stages->watch_thread(trace.parser_thread_id(), PERF_STAGE_INPUT);
+        }
+        trace.release_parser();
+    }
+    if(options.parallel != 0 && !trace.is_binary())
+    {
+        printf("Error: --parallel needs a binary trace (see sim convert)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Resume from a snapshot: restore the predictor state and counters, and skip the branches already simulated
+    if(options.restore != NULL)
+    {
+        uint64_t offset = BHT.load_snapshot(options.restore, true);
+        if(trace.skip(offset) != offset)
+        {
+            printf("Error: Trace %s is shorter than the snapshot offset %llu\n", trace_file, (unsigned long long)offset);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if(options.warm_start != NULL)
+    {
+        BHT.load_snapshot(options.warm_start, false);
+    }
+
+    // Pick the predictor kernel once, then run the whole trace through it. Only profiled runs pay for the
+    // per-branch instrumentation.
+    std::vector<double> unit_rates;
+    auto simulate = [&](auto& kernel)
+    {
+        auto step = [&](uint64_t addr, char outcome)
+        {
+            kernel.step(addr, outcome == 't');
+        };
+
+        if(options.sample_unit != 0)
+        {
+            unit_rates = run_sampled(kernel, BHT, trace, options);
+            return;
+        }
 
+        if(stages != NULL)
+        {
+            run_instrumented(kernel, trace, *stages);
+            return;
+        }
 
-        // Make a prediction
-        if(strcmp(params.bp_name, "bimodal") == 0){
-            BHT.predict_bimodal_branch(addr, outcome);
-        } else if(strcmp(params.bp_name, "gshare") == 0){
-            BHT.predict_gshare_branch(addr, outcome);
-        } else if(strcmp(params.bp_name, "hybrid") == 0){
-            BHT.predict_hybrid_branch(addr, outcome);
+        if(options.checkpoint == NULL)
+        {
+            trace.run(UINT64_MAX, step);
+            return;
         }
 
+        // Save a checkpoint after every checkpoint_interval branches
+        while(trace.run(options.checkpoint_interval, step) == options.checkpoint_interval)
+        {
+            kernel.finish();
+            BHT.save_snapshot(options.checkpoint, trace.position());
+        }
+    };
+    std::vector<uint64_t> chunk_mispredictions;
+    double parallel_seconds = 0;
+    if(options.parallel != 0)
+    {
+        auto start = std::chrono::steady_clock::now();
+        chunk_mispredictions = run_parallel(BHT, trace_file, trace.length(), options);
+        parallel_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    else if(options.profile != NULL)
+    {
+        BranchProfiler profiler(options.profile_interval);
+        BHT.with_kernel(profiler, simulate);
+        profiler.write(options.profile, options.profile_top);
+    }
+    else
+    {
+        BHT.with_kernel(simulate);
+    }
+    if(stages != NULL)
+    {
+        stages->stop();
+    }
+
+    if(options.save_snapshot != NULL)
+    {
+        BHT.save_snapshot(options.save_snapshot, trace.position());
+    }
+
+    if(cache != NULL)
+    {
+        cache->store(BHT, cache_tables);
+        delete cache;
     }
 
     // Print the contents of the branch history table
-    BHT.print_contents();
+    if(stages != NULL)
+    {
+        stages->enter(PERF_STAGE_OUTPUT);
+    }
+    BHT.print_contents(options.dump, options.dump_file);
+    if(stages != NULL)
+    {
+        stages->stop();
+        stages->print();
+        delete stages;
+    }
+
+    if(options.sample_unit != 0)
+    {
+        print_sampling(BHT, unit_rates, options);
+    }
+
+    if(options.parallel != 0)
+    {
+        print_parallel(BHT, trace_file, trace.length(), chunk_mispredictions, parallel_seconds, options);
+    }
 
     return 0;
 }
@@ -1,7 +1,17 @@
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include <cmath>
 #include <iomanip>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "counter_table.h"
+#include "history.h"
+#include "tage.h"
+#include "perceptron.h"
 #ifndef SIM_BP_H
 #define SIM_BP_H
 
@@ -15,36 +25,264 @@ typedef struct bp_params{
 
 // Put additional data structures here as per your requirement
 
+// Predictor type, resolved from bp_name once when the branch history table is built
+enum bp_type{
+    BP_BIMODAL,
+    BP_GSHARE,
+    BP_HYBRID,
+    BP_TAGE,
+    BP_PERCEPTRON,
+    BP_UNKNOWN
+};
+
+// The counter tables of a branch history table
+enum bp_table{
+    BP_TABLE_BIMODAL,
+    BP_TABLE_GSHARE,
+    BP_TABLE_CHOOSER
+};
+
+inline bp_type get_bp_type(const char* bp_name){
+    if(strcmp(bp_name, "bimodal") == 0){
+        return BP_BIMODAL;
+    } else if(strcmp(bp_name, "gshare") == 0){
+        return BP_GSHARE;
+    } else if(strcmp(bp_name, "hybrid") == 0){
+        return BP_HYBRID;
+    } else if(strcmp(bp_name, "tage") == 0){
+        return BP_TAGE;
+    } else if(strcmp(bp_name, "perceptron") == 0){
+        return BP_PERCEPTRON;
+    }
+    return BP_UNKNOWN;
+}
+
+/*  Predictor policies
+
+    The predictors are assembled from small policy types so that everything that depends only on
+    bp_params (masks, shifts, whether there is any history at all) is fixed when a kernel is built,
+    and the per-branch code is a tight, fully inlined loop body:
+      - counter policy:  width of the saturating counters (counter_table.h)
+      - index policy:    how a PC (and the history) maps to a table index
+      - history policy:  the global history register, its folded form when N > M1, or none when N = 0
+      - profiler policy: per-branch instrumentation, or none
+*/
+
+// Index policy: bits m+1 through 2 of the PC (the lowest two bits are always zero)
+struct pc_index{
+    uint64_t mask;
+
+    explicit pc_index(uint64_t m) : mask(((uint64_t)1 << m) - 1) {}
+    uint64_t operator()(uint64_t addr) const {
+        return (addr >> 2) & mask;
+    }
+};
+
+// Index policy: the n-bit global history XORed with the uppermost n of the m PC bits, concatenated with
+// the lower m-n PC bits. Without history (n = 0) this is plain PC indexing. Histories longer than m bits
+// are folded to m bits first (folded_history_register), so n is at most m here.
+template<bool UseHistory>
+struct gshare_index{
+    uint64_t mask;         // m PC bits
+    uint64_t low_mask;     // lower m-n PC bits
+    unsigned int      shift;        // m-n
+
+    gshare_index(uint64_t m, uint64_t n) : mask(((uint64_t)1 << m) - 1), low_mask(((uint64_t)1 << (m - n)) - 1), shift(m - n) {}
+    uint64_t operator()(uint64_t addr, uint64_t history) const {
+        uint64_t index = (addr >> 2) & mask;
+        if(!UseHistory){
+            return index;
+        }
+        return (((index >> shift) ^ history) << shift) | (index & low_mask);
+    }
+};
+
+// History policy: n-bit global history register. It is shifted right by 1 bit position and the branch's
+// actual outcome is placed into the most-significant bit position. Without history it is never updated.
+// The history buffer is only used by folded_history_register.
+template<bool UseHistory>
+struct global_history_register{
+    uint64_t value;
+    unsigned int      top;          // n-1
+
+    global_history_register(uint64_t value, uint64_t n, uint64_t, history_buffer&)
+        : value(value), top(n > 0 ? n - 1 : 0) {}
+    void update(bool taken){
+        if(UseHistory){
+            value = (value >> 1) | ((uint64_t)taken << top);
+        }
+    }
+};
+
+// History policy for n > m: the n-bit global history register, shifted as above, XOR-folded into m bits
+// (bit i of value is the XOR of history bits i, i+m, i+2m, ...). The outcomes themselves are kept in a
+// circular buffer; each update rotates the folded value right by one after removing the outcome that leaves
+// the window, then adds the new outcome at bit (n-1) mod m, in O(1) whatever n is. With n <= m this is
+// exactly global_history_register.
+struct folded_history_register{
+    uint64_t value;
+    unsigned int      top;          // (n-1) mod m
+    unsigned int      width;        // m
+    uint64_t length;       // n
+    history_buffer&   outcomes;
+
+    folded_history_register(uint64_t value, uint64_t n, uint64_t m, history_buffer& outcomes)
+        : value(value), top((unsigned int)((n - 1) % m)), width((unsigned int)m), length(n), outcomes(outcomes) {}
+    void update(bool taken){
+        uint64_t v = value ^ outcomes[length - 1];
+        value = ((v >> 1) | ((v & 1) << (width - 1))) ^ ((uint64_t)taken << top);
+        outcomes.push(taken);
+    }
+};
+
+// Profiler policy: called once per measured branch with whether it was mispredicted. The null profiler
+// compiles to nothing; BranchProfiler (profile.h) is the real one.
+struct null_profiler{
+    void record(unsigned long int, bool) {}
+};
+
+// Output mode of print_contents
+enum dump_mode{
+    DUMP_TEXT,      // counters, then every table entry as text
+    DUMP_BINARY,    // counters as text; the tables as raw bytes to a file
+    DUMP_SPARSE,    // counters, then only the table entries that differ from their initial value
+    DUMP_STATS      // counters only
+};
+
+inline dump_mode get_dump_mode(const char* name){
+    if(strcmp(name, "text") == 0){
+        return DUMP_TEXT;
+    } else if(strcmp(name, "binary") == 0){
+        return DUMP_BINARY;
+    } else if(strcmp(name, "sparse") == 0){
+        return DUMP_SPARSE;
+    } else if(strcmp(name, "stats") == 0){
+        return DUMP_STATS;
+    }
+    printf("Error: Unknown dump mode %s\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/*  Predictor state snapshot (see save_snapshot / load_snapshot)
+
+    bp_snapshot_header, followed by the raw packed words of the bimodal, gshare and chooser tables in that
+    order, and for tage and perceptron by their own state (tage_predictor::write, perceptron_predictor::write),
+    or for gshare and hybrid with N > M1 by the long history buffer. trace_offset is the number
+    of trace branches that had been simulated when the snapshot was taken.
+*/
+#define BP_SNAPSHOT_MAGIC   "BPSNAP"
+#define BP_SNAPSHOT_VERSION 1
+
+typedef struct bp_snapshot_header{
+    char     magic[8];                  // BP_SNAPSHOT_MAGIC, NUL padded
+    uint32_t version;                   // BP_SNAPSHOT_VERSION
+    uint32_t type;                      // bp_type
+    uint64_t K, M1, M2, N;              // bp_params
+    uint64_t trace_offset;
+    uint64_t number_of_predictions;
+    uint64_t number_of_mispredictions;
+    uint64_t global_history;
+    uint64_t table_words[3];            // packed words in the bimodal, gshare and chooser tables
+}bp_snapshot_header;
+
+// Member functions are defined inline below so the header can be shared by several translation units (sim_bp.cc, sweep.cc)
+
 class BranchHistoryTable{
 public:
-    // Vector of ints to store the history of the branch predictor
-    std::vector<int> bimodal_table;     // Branch history counter goes from 0 to 3 with 0 being strongly not taken and 3 being strongly taken
-    std::vector<int> gshare_table;      // Branch history counter goes from 0 to 3 with 0 being strongly not taken and 3 being strongly taken
-    std::vector<int> hybrid_table;     // Branch history counter goes from 0 to 3 with 0 being strongly not taken and 3 being strongly taken
+    // Packed 2-bit counter tables to store the history of the branch predictor
+    typedef packed_counter_table<counter_2bit> counter_table;
+    counter_table bimodal_table;     // Branch history counter goes from 0 to 3 with 0 being strongly not taken and 3 being strongly taken
+    counter_table gshare_table;      // Branch history counter goes from 0 to 3 with 0 being strongly not taken and 3 being strongly taken
+    counter_table hybrid_table;     // Branch history counter goes from 0 to 3 with 0 being strongly not taken and 3 being strongly taken
+
+    // The same tables allocated page by page on first touch, used instead of the ones above with sparse
+    typedef sparse_counter_table<counter_2bit> sparse_table;
+    sparse_table sparse_bimodal_table;
+    sparse_table sparse_gshare_table;
+    sparse_table sparse_hybrid_table;
+    bool sparse;
 
-    int bimodal_index_size;     // Size of the index for the bimodal predictor
-    int gshare_index_size;     // Size of the index for the gshare predictor
-    int hybrid_index_size;     // Size of the index for the hybrid predictor
+    size_t bimodal_index_size;     // Size of the index for the bimodal predictor
+    size_t gshare_index_size;     // Size of the index for the gshare predictor
+    size_t hybrid_index_size;     // Size of the index for the hybrid predictor
 
-    int global_history;     // Global history register - used for gshare predictor
+    uint64_t global_history;     // Global history register - used for gshare predictor (folded to M1 bits if N > M1)
+    history_buffer long_history;    // The last N outcomes, kept only when N > M1 (see folded_history_register)
+
+    tage_predictor tage;    // Tagged tables of the tage predictor, which uses bimodal_table as its base predictor
+    perceptron_predictor perceptron;    // Weights and long global history of the perceptron predictor
 
     bp_params bp_param; // store the parameters for the current branch predictor
+    bp_type   type;     // predictor type decoded from bp_param.bp_name
 
     // Measurement counters
-    int number_of_predictions;  // number of dynamic branches in the trace
-    int number_of_mispredictions; // predicted taken when not-taken, or predicted not-taken when taken
+    uint64_t number_of_predictions;  // number of dynamic branches in the trace
+    uint64_t number_of_mispredictions; // predicted taken when not-taken, or predicted not-taken when taken
+
 
+    BranchHistoryTable(bp_params bp_param, bool sparse = false);
+    void predict_bimodal_branch(uint64_t addr, char outcome);
+    void predict_gshare_branch(uint64_t addr, char outcome);
+    void predict_hybrid_branch(uint64_t addr, char outcome);
 
-    BranchHistoryTable(bp_params bp_param);
-    void predict_bimodal_branch(int addr, char outcome);
-    void predict_gshare_branch(int addr, char outcome);
-    void predict_hybrid_branch(int addr, char outcome);
+    // Counter table id in the Table backend (counter_table or sparse_table); with_table calls body(table)
+    // with the table of whichever backend this branch history table uses
+    template<class Table> Table& counters(bp_table id);
+    template<class Body> void with_table(bp_table id, Body body);
 
-    void print_contents();
+    // Build the kernel specialized for this configuration and call body(kernel); body then calls
+    // kernel.step(addr, taken) once per branch, or kernel.warm(addr, taken) to update the predictor state
+    // without statistics. The predictor type is dispatched here, once, rather than per branch.
+    template<class Body> void with_kernel(Body body);
+
+    // Same, with every measured branch also reported to profiler.record(addr, mispredicted)
+    template<class Profiler, class Body> void with_kernel(Profiler& profiler, Body body);
+
+    // Print the measurement counters and, depending on mode, the final table contents. The text dump is
+    // formatted into a buffer and written with a few large writes. DUMP_BINARY writes one byte per counter
+    // to dump_file, the tables in the order the text dump lists them.
+    void print_contents(dump_mode mode = DUMP_TEXT, const char* dump_file = NULL);
+
+    // True if the global history is longer than the gshare index and is kept folded (N > M1)
+    bool long_history_used() const { return bp_param.N > bp_param.M1 && bp_param.M1 > 0; }
+
+    // Write the complete predictor state (tables, global history, measurement counters, bp_params) to
+    // snapshot_file. The file is written under a temporary name and renamed into place, so an interrupted
+    // checkpoint never clobbers the previous one.
+    void save_snapshot(const char* snapshot_file, uint64_t trace_offset);
+
+    // Load a snapshot taken with the same bp_params. With resume, the measurement counters are restored too
+    // and the trace offset to resume from is returned; otherwise only the predictor state is loaded (a warm
+    // start) and 0 is returned.
+    uint64_t load_snapshot(const char* snapshot_file, bool resume);
 };
 
-BranchHistoryTable::BranchHistoryTable(bp_params bp_param){
+template<>
+inline BranchHistoryTable::counter_table& BranchHistoryTable::counters<BranchHistoryTable::counter_table>(bp_table id){
+    return (id == BP_TABLE_BIMODAL) ? bimodal_table : (id == BP_TABLE_GSHARE) ? gshare_table : hybrid_table;
+}
+
+template<>
+inline BranchHistoryTable::sparse_table& BranchHistoryTable::counters<BranchHistoryTable::sparse_table>(bp_table id){
+    return (id == BP_TABLE_BIMODAL) ? sparse_bimodal_table : (id == BP_TABLE_GSHARE) ? sparse_gshare_table : sparse_hybrid_table;
+}
+
+template<class Body>
+inline void BranchHistoryTable::with_table(bp_table id, Body body){
+    if(this->sparse){
+        body(counters<sparse_table>(id));
+    } else {
+        body(counters<counter_table>(id));
+    }
+}
+
+inline BranchHistoryTable::BranchHistoryTable(bp_params bp_param, bool sparse){
     this->bp_param = bp_param;
+    this->type = get_bp_type(bp_param.bp_name);
+    this->sparse = sparse;
+    auto resize = [&](bp_table id, size_t n, int value){
+        with_table(id, [&](auto& table){ table.resize(n, value); });
+    };
 
     // Initialize measurement counters
     this->number_of_predictions = 0;
@@ -52,375 +290,640 @@ BranchHistoryTable::BranchHistoryTable(bp_params bp_param){
 
     // initialize the global history register
     this->global_history = 0;
+    if((this->type == BP_GSHARE || this->type == BP_HYBRID) && this->long_history_used()){
+        long_history.resize(bp_param.N);
+    }
 
     // Check what type of branch predictor is being used and initialize the tables accordingly
-    if(strcmp(bp_param.bp_name, "bimodal") == 0){
+    if(this->type == BP_BIMODAL){
         // Initialize the bimodal table with the number of indexes = 2^M2
-        this->bimodal_index_size = (int)std::pow(2, bp_param.M2);
-        bimodal_table.resize(this->bimodal_index_size);
-
+        this->bimodal_index_size = (size_t)1 << bp_param.M2;
         // Initalize all branch history counters to 2 (weakly taken)
-        for(int i = 0; i < bimodal_table.size(); i++){
-            bimodal_table[i] = 2;
-        }
-    } else if(strcmp(bp_param.bp_name, "gshare") == 0){
+        resize(BP_TABLE_BIMODAL, this->bimodal_index_size, 2);
+    } else if(this->type == BP_GSHARE){
         // Initialize the gshare table
-        this->gshare_index_size = (int)std::pow(2, bp_param.M1);
-        gshare_table.resize(this->gshare_index_size);
-
+        this->gshare_index_size = (size_t)1 << bp_param.M1;
         // Initalize all branch history counters to 2 (weakly taken)
-        for(int i = 0; i < gshare_table.size(); i++){
-            gshare_table[i] = 2;
-        }
-    } else if(strcmp(bp_param.bp_name, "hybrid") == 0){
+        resize(BP_TABLE_GSHARE, this->gshare_index_size, 2);
+    } else if(this->type == BP_HYBRID){
         // Initialize the hybrid table by creating a bimodal predictor and a gshare predictor
         
         // Initialize the bimodal predictor
-        this->bimodal_index_size = (int)std::pow(2, bp_param.M2);
-        bimodal_table.resize(this->bimodal_index_size);
-
+        this->bimodal_index_size = (size_t)1 << bp_param.M2;
         // Initalize all branch history counters to 2 (weakly taken)
-        for(int i = 0; i < bimodal_table.size(); i++){
-            bimodal_table[i] = 2;
-        }
+        resize(BP_TABLE_BIMODAL, this->bimodal_index_size, 2);
 
         // Initialize the gshare predictor
-        this->gshare_index_size = (int)std::pow(2, bp_param.M1);
-        gshare_table.resize(this->gshare_index_size);
-
+        this->gshare_index_size = (size_t)1 << bp_param.M1;
         // Initalize all branch history counters to 2 (weakly taken)
-        for(int i = 0; i < gshare_table.size(); i++){
-            gshare_table[i] = 2;
-        }
+        resize(BP_TABLE_GSHARE, this->gshare_index_size, 2);
 
         // Initialize the hybrid chooser table of size 2^K 2 bit counters
-        this->hybrid_index_size = (int)std::pow(2, bp_param.K); 
-        hybrid_table.resize(this->hybrid_index_size);
-        for(int i = 0; i < hybrid_table.size(); i++){
-            hybrid_table[i] = 1;    // all counters in chooser table are initialized to 1 (weakly not taken)
-        }
+        this->hybrid_index_size = (size_t)1 << bp_param.K;
+        resize(BP_TABLE_CHOOSER, this->hybrid_index_size, 1);    // all counters in chooser table are initialized to 1 (weakly not taken)
+    } else if(this->type == BP_TAGE){
+        // Initialize the base predictor
+        this->bimodal_index_size = (size_t)1 << bp_param.M2;
+        // Initalize all branch history counters to 2 (weakly taken)
+        resize(BP_TABLE_BIMODAL, this->bimodal_index_size, 2);
+
+        // Initialize K tagged tables of 2^M1 entries with history lengths up to N
+        tage.init(bp_param.K, bp_param.M1, bp_param.N);
+    } else if(this->type == BP_PERCEPTRON){
+        // Initialize 2^M1 perceptrons over N bits of global history
+        perceptron.init(bp_param.M1, bp_param.N);
     }
 }
 
-void BranchHistoryTable::predict_bimodal_branch(int addr, char outcome){
-    bool prediction;    // True if taken, False if not-taken
-
-    // Update measurement counters
-    this->number_of_predictions++;
+/*  Predictor kernels
 
-    // Step 1: Determine the branch's index into the prediction table.
-    // discard the lowest two bits of the PC, since these are always zero, i.e., use bits m+1 through 2 of the PC.
-    int index = addr >> 2;
+    Each kernel copies what it needs out of the branch history table when it is built (table references,
+    index and history policies, measurement counters), so the compiler can keep all of it in registers
+    across the trace loop. finish() writes the counters and history back into the table.
+*/
 
-    // Mask bits m+1 through 2 of the PC
-    index = index & ((1 << bp_param.M2) - 1);
+template<class Table, class Profiler = null_profiler>
+class bimodal_kernel{
+public:
+    bimodal_kernel(BranchHistoryTable& bht, Profiler& profiler)
+        : bht(bht), profiler(profiler), table(bht.template counters<Table>(BP_TABLE_BIMODAL)), index(bht.bp_param.M2), predictions(0), mispredictions(0) {}
+
+    // Simulate one branch and return its prediction. With Stats false the predictor state is updated but the
+    // measurement counters are left alone, which is what functional warming needs.
+    template<bool Stats = true>
+    bool step(uint64_t addr, bool taken){
+        // Update measurement counters
+        predictions += Stats;
+
+        // Step 1: Determine the branch's index into the prediction table.
+        unsigned long int i = index(addr);
+
+        // Step 2: Make a prediction. Use index to get the branch's counter from the prediction table.
+        bool prediction = table.predict(i);
+
+        // Step 3: Update the branch predictor based on the branch's actual outcome.
+        mispredictions += Stats && (prediction != taken);
+        if(Stats){
+            profiler.record(addr, prediction != taken);
+        }
+        table.update(i, taken);
+        return prediction;
+    }
 
-    // Step 2: Make a prediction. Use index to get the branch’s counter from the prediction table. If the
-    // counter value is greater than or equal to 2, then the branch is predicted taken, else it is predicted
-    // not-taken.
-    if(bimodal_table[index] >= 2){
-        prediction = true;
-    } else {
-        prediction = false;
-    }
-
-    // Step 3: Update the branch predictor based on the branch’s actual outcome. The branch’s counter in
-    // the prediction table is incremented if the branch was taken, decremented if the branch was not-
-    // taken. The counter saturates at the extremes (0 and 3), however.
-    if(outcome == 't'){
-        if(!prediction){    // If the prediction is not taken, but the outcome is taken, then it is a misprediction
-            // Update measurement counters
-            this->number_of_mispredictions++;
-        } 
-        bimodal_table[index] = std::min(bimodal_table[index] + 1, 3);
-    } else if(outcome == 'n'){
-        if(prediction){    // If the prediction is taken, but the outcome is not-taken, then it is a misprediction
-            // Update measurement counters
-            this->number_of_mispredictions++;
-        } 
-        bimodal_table[index] = std::max(bimodal_table[index] - 1, 0);
-    } 
-}
+    // The prediction step() would make for the branch at addr, without changing any state
+    bool predict(uint64_t addr) const {
+        return table.predict(index(addr));
+    }
 
-void BranchHistoryTable::predict_gshare_branch(int addr, char outcome){
-    // Local variables
-    bool prediction = false;    // True if taken, False if not-taken
-    int current_index = 0;
-    int upper_n_bits = 0;
-    int m_minus_n_bits = 0;
-    int xor_result = 0;
-    int concatenated_index = 0;
-    bool N_is_zero = false;
+    void warm(uint64_t addr, bool taken){
+        step<false>(addr, taken);
+    }
 
-    // Check if N is zero
-    if(this->bp_param.N == 0){
-        N_is_zero = true;
+    void finish(){
+        bht.number_of_predictions += predictions;
+        bht.number_of_mispredictions += mispredictions;
+        predictions = 0;
+        mispredictions = 0;
     }
 
-    // Update measurement counters
-    this->number_of_predictions++;
+private:
+    BranchHistoryTable& bht;
+    Profiler&           profiler;
+    Table&              table;
+    pc_index            index;
+    uint64_t            predictions;
+    uint64_t            mispredictions;
+};
 
-    // Step 1: Determine the branch’s index into the prediction table. Fig. 2 shows how to generate the
-    // index: the current n-bit global branch history register is XORed with the uppermost n bits of the
-    // m PC bits.
+template<class Table, bool UseHistory, class Profiler = null_profiler, class History = global_history_register<UseHistory> >
+class gshare_kernel{
+public:
+    gshare_kernel(BranchHistoryTable& bht, Profiler& profiler)
+        : bht(bht), profiler(profiler), table(bht.template counters<Table>(BP_TABLE_GSHARE)), index(bht.bp_param.M1, std::min(bht.bp_param.N, bht.bp_param.M1)),
+          history(bht.global_history, bht.bp_param.N, bht.bp_param.M1, bht.long_history), predictions(0), mispredictions(0) {}
+
+    // Simulate one branch and return its prediction. With Stats false the predictor state is updated but the
+    // measurement counters are left alone, which is what functional warming needs.
+    template<bool Stats = true>
+    bool step(uint64_t addr, bool taken){
+        // Update measurement counters
+        predictions += Stats;
+
+        // Step 1: Determine the branch's index into the prediction table: the current n-bit global branch
+        // history register is XORed with the uppermost n bits of the m PC bits.
+        unsigned long int i = index(addr, history.value);
+
+        // Step 2: Make a prediction. Use index to get the branch's counter from the prediction table.
+        bool prediction = table.predict(i);
+
+        // Step 3: Update the branch predictor based on the branch's actual outcome.
+        mispredictions += Stats && (prediction != taken);
+        if(Stats){
+            profiler.record(addr, prediction != taken);
+        }
+        table.update(i, taken);
 
-    // calculate m - n
-    int M1 = this->bp_param.M1;
-    int N = this->bp_param.N;
-    m_minus_n_bits = M1 - N;
+        // Step 4: Update the global branch history register.
+        history.update(taken);
+        return prediction;
+    }
 
-    // Discard the lowest two bits of the PC, since these are always zero, i.e., use bits m+1 through 2 of the PC.
-    current_index = (addr >> 2);
+    // The prediction step() would make for the branch at addr, without changing any state
+    bool predict(uint64_t addr) const {
+        return table.predict(index(addr, history.value));
+    }
 
-    // Mask M1 bits from the PC
-    current_index = current_index & ((1 << M1) - 1);
+    void warm(uint64_t addr, bool taken){
+        step<false>(addr, taken);
+    }
 
-    if(!N_is_zero){
-        // Mask the upper n bits of the PC (shift off m-n bits)
-        upper_n_bits = current_index >> m_minus_n_bits;
+    void finish(){
+        bht.number_of_predictions += predictions;
+        bht.number_of_mispredictions += mispredictions;
+        bht.global_history = history.value;
+        predictions = 0;
+        mispredictions = 0;
+    }
 
-        // XOR the global history register with the upper n bits of the PC
-        xor_result = this->global_history ^ upper_n_bits;
+private:
+    BranchHistoryTable&                 bht;
+    Profiler&                           profiler;
+    Table&                              table;
+    gshare_index<UseHistory>            index;
+    History                             history;
+    uint64_t                            predictions;
+    uint64_t                            mispredictions;
+};
 
-        // Mask out the upper n bits from current_index
-        current_index = current_index & ((1 << m_minus_n_bits) - 1);
+template<class Table, bool UseHistory, class Profiler = null_profiler, class History = global_history_register<UseHistory> >
+class hybrid_kernel{
+public:
+    hybrid_kernel(BranchHistoryTable& bht, Profiler& profiler)
+        : bht(bht), profiler(profiler), bimodal_table(bht.template counters<Table>(BP_TABLE_BIMODAL)),
+          gshare_table(bht.template counters<Table>(BP_TABLE_GSHARE)), chooser_table(bht.template counters<Table>(BP_TABLE_CHOOSER)),
+          bimodal_index(bht.bp_param.M2), chooser_index(bht.bp_param.K), gshare_idx(bht.bp_param.M1, std::min(bht.bp_param.N, bht.bp_param.M1)),
+          history(bht.global_history, bht.bp_param.N, bht.bp_param.M1, bht.long_history), predictions(0), mispredictions(0) {}
+
+    // Simulate one branch and return its prediction. With Stats false the predictor state is updated but the
+    // measurement counters are left alone, which is what functional warming needs.
+    template<bool Stats = true>
+    bool step(uint64_t addr, bool taken){
+        // Update measurement counters
+        predictions += Stats;
+
+        // Step 1: Obtain two predictions, one from the gshare predictor and one from the bimodal predictor
+        unsigned long int gi = gshare_idx(addr, history.value);
+        unsigned long int bi = bimodal_index(addr);
+        bool gshare_prediction = gshare_table.predict(gi);
+        bool bimodal_prediction = bimodal_table.predict(bi);
+
+        // Step 2: Determine the branch's index into the chooser table (bit k+1 to bit 2 of the PC)
+        unsigned long int ci = chooser_index(addr);
+
+        // Step 3: Make an overall prediction. If the chooser counter value is greater than or equal to 2, then use
+        // the prediction that was obtained from the gshare predictor, otherwise use the bimodal prediction.
+        // Step 4: Update the selected branch predictor based on the branch's actual outcome. Only the branch
+        // predictor that was selected in step 3, above, is updated.
+        bool use_gshare = chooser_table.predict(ci);
+        if(use_gshare){
+            mispredictions += Stats && (gshare_prediction != taken);
+            if(Stats){
+                profiler.record(addr, gshare_prediction != taken);
+            }
+            gshare_table.update(gi, taken);
+        } else {
+            mispredictions += Stats && (bimodal_prediction != taken);
+            if(Stats){
+                profiler.record(addr, bimodal_prediction != taken);
+            }
+            bimodal_table.update(bi, taken);
+        }
 
-        // concatenate the result with the lower m-n bits of the PC
-        concatenated_index = xor_result << m_minus_n_bits;
-    }
-    concatenated_index = concatenated_index | current_index;
+        // Step 5: Note that the gshare global branch history register must always be updated, even if bimodal
+        // was selected.
+        history.update(taken);
 
-    // Step 2: Make a prediction. Use index to get the branch’s counter from the prediction table. If the
-    // counter value is greater than or equal to 2, then the branch is predicted taken, else it is predicted
-    // not-taken.
-    if(gshare_table[concatenated_index] >= 2){
-        prediction = true;
-    } else {
-        prediction = false;
-    }
-
-    // Step 3: Update the branch predictor based on the branch’s actual outcome. The branch’s counter in
-    // the prediction table is incremented if the branch was taken, decremented if the branch was not-
-    // taken. The counter saturates at the extremes (0 and 3), however.
-    if(outcome == 't'){
-        if(!prediction){    // If the prediction is not taken, but the outcome is taken, then it is a misprediction
-            // Update measurement counters
-            this->number_of_mispredictions++;
-        } 
-        gshare_table[concatenated_index] = std::min(gshare_table[concatenated_index] + 1, 3);
-    } else if(outcome == 'n'){
-        if(prediction){    // If the prediction is taken, but the outcome is not-taken, then it is a misprediction
-            // Update measurement counters
-            this->number_of_mispredictions++;
-        } 
-        gshare_table[concatenated_index] = std::max(gshare_table[concatenated_index] - 1, 0);
-    }
-
-    // Step 4: Update the global branch history register. Shift the register right by 1 bit position, and place
-    // the branch’s actual outcome into the most-significant bit position of the register.
-    int outcome_bit = 0;
-    if(outcome == 't'){
-        outcome_bit = 1;
-    } else if(outcome == 'n'){
-        outcome_bit = 0;
-    } 
-
-    this->global_history = (this->global_history >> 1) | (outcome_bit << (this->bp_param.N - 1)); 
+        // Step 6: Update the branch's chooser counter towards the predictor that was correct. If both are
+        // incorrect, or both are correct, then no change is made to the chooser counter.
+        bool gshare_correct = (gshare_prediction == taken);
+        if(gshare_correct != (bimodal_prediction == taken)){
+            chooser_table.update(ci, gshare_correct);
+        }
+        return use_gshare ? gshare_prediction : bimodal_prediction;
+    }
 
-}
+    // The prediction step() would make for the branch at addr, without changing any state
+    bool predict(uint64_t addr) const {
+        if(chooser_table.predict(chooser_index(addr))){
+            return gshare_table.predict(gshare_idx(addr, history.value));
+        }
+        return bimodal_table.predict(bimodal_index(addr));
+    }
 
-void BranchHistoryTable::predict_hybrid_branch(int addr, char outcome){
-    // Local variables
-    char hybrid_prediction = '1';    // '1' if gshare is selected, '0' if bimodal is selected
+    void warm(uint64_t addr, bool taken){
+        step<false>(addr, taken);
+    }
 
-    // Update measurement counters
-    this->number_of_predictions++;
+    void finish(){
+        bht.number_of_predictions += predictions;
+        bht.number_of_mispredictions += mispredictions;
+        bht.global_history = history.value;
+        predictions = 0;
+        mispredictions = 0;
+    }
 
-    // Step 1: Obtain two predictions, one from the bimodal predictor and one from the gshare predictor
-    // gshare prediction
-    bool gshare_prediction = false;    // True if taken, False if not-taken
-    int M_index = 0;
-    int upper_n_bits = 0;
-    int m_minus_n_bits = 0;
-    int xor_result = 0;
-    int concatenated_index = 0;
-    bool N_is_zero = false;
+private:
+    BranchHistoryTable&                 bht;
+    Profiler&                           profiler;
+    Table&                              bimodal_table;
+    Table&                              gshare_table;
+    Table&                              chooser_table;
+    pc_index                            bimodal_index;
+    pc_index                            chooser_index;
+    gshare_index<UseHistory>            gshare_idx;
+    History                             history;
+    uint64_t                            predictions;
+    uint64_t                            mispredictions;
+};
 
-    // Check if N is zero
-    if(this->bp_param.N == 0){
-        N_is_zero = true;
+template<class Table, class Profiler = null_profiler>
+class tage_kernel{
+public:
+    tage_kernel(BranchHistoryTable& bht, Profiler& profiler)
+        : bht(bht), profiler(profiler), base_table(bht.template counters<Table>(BP_TABLE_BIMODAL)), base_index(bht.bp_param.M2), tage(bht.tage),
+          predictions(0), mispredictions(0) {}
+
+    // Simulate one branch and return its prediction. With Stats false the predictor state is updated but the
+    // measurement counters are left alone, which is what functional warming needs.
+    template<bool Stats = true>
+    bool step(uint64_t addr, bool taken){
+        // Update measurement counters
+        predictions += Stats;
+
+        // Predict from the tagged tables (falling back to the base predictor) and train them (see tage.h)
+        bool prediction = tage.step(base_table, base_index(addr), addr, taken);
+        mispredictions += Stats && (prediction != taken);
+        if(Stats){
+            profiler.record(addr, prediction != taken);
+        }
+        return prediction;
     }
 
-    // Step 1: Determine the branch’s index into the prediction table. 
-    // calculate m - n
-    int M1 = this->bp_param.M1;
-    int N = this->bp_param.N;
-    m_minus_n_bits = M1 - N;
+    // The prediction step() would make for the branch at addr, without changing any state
+    bool predict(uint64_t addr) const {
+        return tage.predict(base_table, base_index(addr), addr);
+    }
 
-    // Discard the lowest two bits of the PC, since these are always zero, i.e., use bits m+1 through 2 of the PC.
-    M_index = (addr >> 2);
+    void warm(uint64_t addr, bool taken){
+        step<false>(addr, taken);
+    }
 
-    // Mask M1 bits from the PC
-    M_index = M_index & ((1 << M1) - 1);
+    void finish(){
+        bht.number_of_predictions += predictions;
+        bht.number_of_mispredictions += mispredictions;
+        predictions = 0;
+        mispredictions = 0;
+    }
 
-    if(!N_is_zero){
-        // Mask the upper n bits of the PC (shift off m-n bits)
-        upper_n_bits = M_index >> m_minus_n_bits;
+private:
+    BranchHistoryTable& bht;
+    Profiler&           profiler;
+    Table&              base_table;
+    pc_index            base_index;
+    tage_predictor&     tage;
+    uint64_t            predictions;
+    uint64_t            mispredictions;
+};
 
-        // XOR the global history register with the upper n bits of the PC
-        xor_result = this->global_history ^ upper_n_bits;
+template<class Table, class Profiler = null_profiler>
+class perceptron_kernel{
+public:
+    perceptron_kernel(BranchHistoryTable& bht, Profiler& profiler)
+        : bht(bht), profiler(profiler), perceptron(bht.perceptron), predictions(0), mispredictions(0) {}
+
+    // Simulate one branch and return its prediction. With Stats false the predictor state is updated but the
+    // measurement counters are left alone, which is what functional warming needs.
+    template<bool Stats = true>
+    bool step(uint64_t addr, bool taken){
+        // Update measurement counters
+        predictions += Stats;
+
+        // Predict from the perceptron's output and train it (see perceptron.h)
+        bool prediction = perceptron.step(addr, taken);
+        mispredictions += Stats && (prediction != taken);
+        if(Stats){
+            profiler.record(addr, prediction != taken);
+        }
+        return prediction;
+    }
 
-        // Mask out the upper n bits from M_index
-        M_index = M_index & ((1 << m_minus_n_bits) - 1);
+    // The prediction step() would make for the branch at addr, without changing any state
+    bool predict(uint64_t addr) const {
+        return perceptron.predict(addr);
+    }
 
-        // concatenate the result with the lower m-n bits of the PC
-        concatenated_index = xor_result << m_minus_n_bits;
+    void warm(uint64_t addr, bool taken){
+        step<false>(addr, taken);
     }
-    concatenated_index = concatenated_index | M_index;
 
-    // Step 2: Make a prediction. 
-    if(gshare_table[concatenated_index] >= 2){
-        gshare_prediction = true;
-    } else {
-        gshare_prediction = false;
+    void finish(){
+        bht.number_of_predictions += predictions;
+        bht.number_of_mispredictions += mispredictions;
+        predictions = 0;
+        mispredictions = 0;
     }
 
-    // Bimodal prediction
-    bool bimodal_prediction = false;    // True if taken, False if not-taken
+private:
+    BranchHistoryTable&     bht;
+    Profiler&               profiler;
+    perceptron_predictor&   perceptron;
+    uint64_t                predictions;
+    uint64_t                mispredictions;
+};
 
-    // Step 1: Determine the branch's index into the prediction table.
-    int bimodal_index = addr >> 2;
+template<class Body>
+inline void BranchHistoryTable::with_kernel(Body body){
+    null_profiler none;
+    with_kernel(none, body);
+}
 
-    // Mask bits m+1 through 2 of the PC
-    bimodal_index = bimodal_index & ((1 << bp_param.M2) - 1);
+// The kernel dispatch of with_kernel for one table backend
+template<class Table, class Profiler, class Body>
+inline void with_table_kernel(BranchHistoryTable& bht, Profiler& profiler, Body body){
+    if(bht.type == BP_BIMODAL){
+        bimodal_kernel<Table, Profiler> kernel(bht, profiler);
+        body(kernel);
+        kernel.finish();
+    } else if(bht.type == BP_GSHARE && (bht.bp_param.N == 0 || bht.bp_param.M1 == 0)){
+        gshare_kernel<Table, false, Profiler> kernel(bht, profiler);
+        body(kernel);
+        kernel.finish();
+    } else if(bht.type == BP_GSHARE && bht.long_history_used()){
+        gshare_kernel<Table, true, Profiler, folded_history_register> kernel(bht, profiler);
+        body(kernel);
+        kernel.finish();
+    } else if(bht.type == BP_GSHARE){
+        gshare_kernel<Table, true, Profiler> kernel(bht, profiler);
+        body(kernel);
+        kernel.finish();
+    } else if(bht.type == BP_HYBRID && (bht.bp_param.N == 0 || bht.bp_param.M1 == 0)){
+        hybrid_kernel<Table, false, Profiler> kernel(bht, profiler);
+        body(kernel);
+        kernel.finish();
+    } else if(bht.type == BP_HYBRID && bht.long_history_used()){
+        hybrid_kernel<Table, true, Profiler, folded_history_register> kernel(bht, profiler);
+        body(kernel);
+        kernel.finish();
+    } else if(bht.type == BP_HYBRID){
+        hybrid_kernel<Table, true, Profiler> kernel(bht, profiler);
+        body(kernel);
+        kernel.finish();
+    } else if(bht.type == BP_TAGE){
+        tage_kernel<Table, Profiler> kernel(bht, profiler);
+        body(kernel);
+        kernel.finish();
+    } else if(bht.type == BP_PERCEPTRON){
+        perceptron_kernel<Table, Profiler> kernel(bht, profiler);
+        body(kernel);
+        kernel.finish();
+    }
+}
 
-    // Step 2: Make a prediction.
-    if(bimodal_table[bimodal_index] >= 2){
-        bimodal_prediction = true;
+template<class Profiler, class Body>
+inline void BranchHistoryTable::with_kernel(Profiler& profiler, Body body){
+    if(this->sparse){
+        with_table_kernel<sparse_table>(*this, profiler, body);
     } else {
-        bimodal_prediction = false;
+        with_table_kernel<counter_table>(*this, profiler, body);
     }
+}
 
+// Single-branch entry points. These build a kernel per call; use with_kernel() to run many branches.
+inline void BranchHistoryTable::predict_bimodal_branch(uint64_t addr, char outcome){
+    with_kernel([&](auto& kernel){
+        kernel.step(addr, outcome == 't');
+    });
+}
 
-    // Step 2: Determine the branch's index into the chooser table. The index for the chooser table is 
-    // bit k+1 to bit 2 of the PC
-    int chooser_index = addr >> 2;
-    chooser_index = chooser_index & ((1 << bp_param.K) - 1);
-    
-    // Step 3: Make an overall prediction. Use the index to get the branch's counter from the chooser table. 
-    // If the chooser counter value is greater than or equal to 2, then use the prediction that was obtained 
-    // from the gshare predictor, otherwise use the prediction that was obtained from the bimodal predictor.
+inline void BranchHistoryTable::predict_gshare_branch(uint64_t addr, char outcome){
+    with_kernel([&](auto& kernel){
+        kernel.step(addr, outcome == 't');
+    });
+}
 
-    if(hybrid_table[chooser_index] >= 2){
-        hybrid_prediction = '1';    // gshare is selected
-    } else {
-        hybrid_prediction = '0';    // bimodal is selected
-    }
-
-    // Step 4: Update the selected branch predictor based on the branch's actual outcome. Only the branch 
-    // predictor that was selected in step 3, above, is updated.
-
-    if(hybrid_prediction == '1'){
-        // Update the gshare predictor
-        if(outcome == 't'){
-            if(!gshare_prediction){    // If the prediction is not taken, but the outcome is taken, then it is a misprediction
-                // Update measurement counters
-                this->number_of_mispredictions++;
-            } 
-            gshare_table[concatenated_index] = std::min(gshare_table[concatenated_index] + 1, 3);
-        } else if(outcome == 'n'){
-            if(gshare_prediction){    // If the prediction is taken, but the outcome is not-taken, then it is a misprediction
-                // Update measurement counters
-                this->number_of_mispredictions++;
-            } 
-            gshare_table[concatenated_index] = std::max(gshare_table[concatenated_index] - 1, 0);
+inline void BranchHistoryTable::predict_hybrid_branch(uint64_t addr, char outcome){
+    with_kernel([&](auto& kernel){
+        kernel.step(addr, outcome == 't');
+    });
+}
+
+// Append the table to a text dump as " index\tcounter" lines, skipping entries equal to skip_value (-1 skips
+// nothing). buffer is flushed to FP whenever it fills up.
+template<class Table>
+inline void dump_table_text(FILE* FP, std::vector<char>& buffer, size_t& used, const char* title,
+                            const Table& table, int skip_value){
+    if(used + 64 > buffer.size()){
+        fwrite(&buffer[0], 1, used, FP);
+        used = 0;
+    }
+    used += sprintf(&buffer[used], "%s\n", title);
+    // Entries that were never written still hold their initial value, so a sparse dump of a sparse table
+    // jumps straight over its untouched pages
+    for(size_t i = 0; i < table.size(); i++){
+        if(skip_value >= 0){
+            i = table.first_touched(i);
+            if(i >= table.size()){
+                break;
+            }
+        }
+        int value = table.get(i);
+        if(value == skip_value){
+            continue;
+        }
+        if(used + 32 > buffer.size()){
+            fwrite(&buffer[0], 1, used, FP);
+            used = 0;
         }
-    } else if(hybrid_prediction == '0'){
-        // Update the bimodal predictor
-        if(outcome == 't'){
-            if(!bimodal_prediction){    // If the prediction is not taken, but the outcome is taken, then it is a misprediction
-                // Update measurement counters
-                this->number_of_mispredictions++;
-
-            } 
-            bimodal_table[bimodal_index] = std::min(bimodal_table[bimodal_index] + 1, 3);
-        } else if(outcome == 'n'){
-            if(bimodal_prediction){    // If the prediction is taken, but the outcome is not-taken, then it is a misprediction
-                // Update measurement counters
-                this->number_of_mispredictions++;
-            } 
-            bimodal_table[bimodal_index] = std::max(bimodal_table[bimodal_index] - 1, 0);
-        } 
-    }
-
-    // Step 5: Note that the gshare global branch history register must always be updated, even if bimodal
-    // was selected.
-    int outcome_bit = 0;
-    if(outcome == 't'){
-        outcome_bit = 1;
-    } else if(outcome == 'n'){
-        outcome_bit = 0;
-    } 
-
-    this->global_history = (this->global_history >> 1) | (outcome_bit << (this->bp_param.N - 1)); 
-
-    
-    // Step 6: Update the branch's chooser counter. 
-    // If both are incorrect, or both are correct, then no change is made to the chooser counter.
-
-    // If gshare is correct and bimodal is incorrect, then the chooser counter is incremented but saturates at 3.
-    if(((gshare_prediction == true && outcome == 't') || (gshare_prediction == false && outcome == 'n')) && 
-    ((bimodal_prediction == false && outcome == 't') || (bimodal_prediction == true && outcome == 'n'))){
-        hybrid_table[chooser_index] = std::min(hybrid_table[chooser_index] + 1, 3);
-    }
-
-    // If bimodal is correct and gshare is incorrect, then the chooser counter is decremented but saturates at 0.
-    if(((gshare_prediction == false && outcome == 't') || (gshare_prediction == true && outcome == 'n')) && 
-    ((bimodal_prediction == true && outcome == 't') || (bimodal_prediction == false && outcome == 'n'))){
-        hybrid_table[chooser_index] = std::max(hybrid_table[chooser_index] - 1, 0);
+        // " <index>\t<counter>\n", with the index converted by hand
+        char digits[24];
+        size_t n = 0;
+        size_t index = i;
+        do{
+            digits[n++] = (char)('0' + index % 10);
+            index /= 10;
+        }while(index != 0);
+        buffer[used++] = ' ';
+        while(n > 0){
+            buffer[used++] = digits[--n];
+        }
+        buffer[used++] = '\t';
+        buffer[used++] = (char)('0' + value);
+        buffer[used++] = '\n';
     }
 }
 
-void BranchHistoryTable::print_contents(){
-    std::cout << "OUTPUT" << std::endl;
+inline void BranchHistoryTable::print_contents(dump_mode mode, const char* dump_file){
+    std::vector<char> buffer(1 << 16);
+    size_t used = 0;
 
-    float misprediction_rate = 0;
+    double misprediction_rate = 0;
 
     // Calculate the misprediction rate
-    misprediction_rate = (static_cast<float>(this->number_of_mispredictions) / static_cast<float>(this->number_of_predictions)) * 100;
-
-    // Print the measurement counters
-    std::cout << "number of predictions: " << number_of_predictions << std::endl;
-    std::cout << "number of mispredictions: " << number_of_mispredictions << std::endl;
-    // Print the misprediction rate as a percentage with two decimal places
-    std::cout << std::fixed << std::setprecision(2) << "misprediction rate: " << misprediction_rate << "%" << std::endl; 
-
-    if(strcmp(this->bp_param.bp_name, "bimodal") == 0){
-        std::cout << "FINAL BIMODAL CONTENTS" << std::endl;
-        for(int i = 0; i < bimodal_table.size(); i++){
-            std::cout << " " << i << "	" << bimodal_table[i] << std::endl;
+    misprediction_rate = (static_cast<double>(this->number_of_mispredictions) / static_cast<double>(this->number_of_predictions)) * 100;
+
+    // Print the measurement counters and the misprediction rate as a percentage with two decimal places
+    used += sprintf(&buffer[used], "OUTPUT\nnumber of predictions: %llu\nnumber of mispredictions: %llu\nmisprediction rate: %.2f%%\n",
+                    (unsigned long long)number_of_predictions, (unsigned long long)number_of_mispredictions, misprediction_rate);
+
+    // Tables in dump order, with the value every entry is initialized to
+    bp_table tables[3];
+    const char* titles[3];
+    int initial[3];
+    int num_tables = 0;
+    if(this->type == BP_BIMODAL || this->type == BP_TAGE){
+        tables[0] = BP_TABLE_BIMODAL; titles[0] = "FINAL BIMODAL CONTENTS"; initial[0] = 2;
+        num_tables = 1;
+    } else if(this->type == BP_GSHARE){
+        tables[0] = BP_TABLE_GSHARE; titles[0] = "FINAL GSHARE CONTENTS"; initial[0] = 2;
+        num_tables = 1;
+    } else if(this->type == BP_HYBRID){
+        tables[0] = BP_TABLE_CHOOSER; titles[0] = "FINAL CHOOSER CONTENTS"; initial[0] = 1;
+        tables[1] = BP_TABLE_GSHARE; titles[1] = "FINAL GSHARE CONTENTS"; initial[1] = 2;
+        tables[2] = BP_TABLE_BIMODAL; titles[2] = "FINAL BIMODAL CONTENTS"; initial[2] = 2;
+        num_tables = 3;
+    }
+
+    fflush(stdout);
+    if(mode == DUMP_TEXT || mode == DUMP_SPARSE){
+        for(int t = 0; t < num_tables; t++){
+            with_table(tables[t], [&](auto& table){
+                dump_table_text(stdout, buffer, used, titles[t], table, mode == DUMP_SPARSE ? initial[t] : -1);
+            });
+        }
+    }
+    fwrite(&buffer[0], 1, used, stdout);
+    fflush(stdout);
+
+    if(mode == DUMP_BINARY){
+        FILE* FP = fopen(dump_file, "wb");
+        if(FP == NULL){
+            printf("Error: Unable to open file %s\n", dump_file);
+            exit(EXIT_FAILURE);
         }
-    } else if(strcmp(this->bp_param.bp_name, "gshare") == 0){
-        std::cout << "FINAL GSHARE CONTENTS" << std::endl;
-        for(int i = 0; i < gshare_table.size(); i++){
-            std::cout << " " << i << "	" << gshare_table[i] << std::endl;
+        for(int t = 0; t < num_tables; t++){
+            with_table(tables[t], [&](auto& table){
+                for(size_t i = 0; i < table.size(); i += buffer.size()){
+                    size_t n = std::min(buffer.size(), table.size() - i);
+                    for(size_t k = 0; k < n; k++){
+                        buffer[k] = (char)table.get(i + k);
+                    }
+                    fwrite(&buffer[0], 1, n, FP);
+                }
+            });
         }
-    } else if(strcmp(this->bp_param.bp_name, "hybrid") == 0){
-        std::cout << "FINAL CHOOSER CONTENTS" << std::endl;
-        for(int i = 0; i < hybrid_table.size(); i++){
-            std::cout << " " << i << "	" << hybrid_table[i] << std::endl;
+        if(fclose(FP) != 0){
+            printf("Error: Unable to write file %s\n", dump_file);
+            exit(EXIT_FAILURE);
         }
+    }
+}
 
-        std::cout << "FINAL GSHARE CONTENTS" << std::endl;
-        for(int i = 0; i < gshare_table.size(); i++){
-            std::cout << " " << i << "	" << gshare_table[i] << std::endl;
-        }
+inline void BranchHistoryTable::save_snapshot(const char* snapshot_file, uint64_t trace_offset){
+    const bp_table tables[3] = {BP_TABLE_BIMODAL, BP_TABLE_GSHARE, BP_TABLE_CHOOSER};
+
+    bp_snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BP_SNAPSHOT_MAGIC, sizeof(BP_SNAPSHOT_MAGIC));
+    header.version = BP_SNAPSHOT_VERSION;
+    header.type = this->type;
+    header.K = bp_param.K;
+    header.M1 = bp_param.M1;
+    header.M2 = bp_param.M2;
+    header.N = bp_param.N;
+    header.trace_offset = trace_offset;
+    header.number_of_predictions = this->number_of_predictions;
+    header.number_of_mispredictions = this->number_of_mispredictions;
+    header.global_history = this->global_history;
+    for(int t = 0; t < 3; t++){
+        with_table(tables[t], [&](auto& table){ header.table_words[t] = table.num_words(); });
+    }
 
-        std::cout << "FINAL BIMODAL CONTENTS" << std::endl;
-        for(int i = 0; i < bimodal_table.size(); i++){
-            std::cout << " " << i << "	" << bimodal_table[i] << std::endl;
+    std::string tmp_file = std::string(snapshot_file) + ".tmp";
+    FILE* FP = fopen(tmp_file.c_str(), "wb");
+    if(FP == NULL){
+        printf("Error: Unable to open file %s\n", tmp_file.c_str());
+        exit(EXIT_FAILURE);
+    }
+    fwrite(&header, sizeof(header), 1, FP);
+    for(int t = 0; t < 3; t++){
+        with_table(tables[t], [&](auto& table){ table.write(FP); });
+    }
+    if(this->type == BP_TAGE){
+        tage.write(FP);
+    } else if(this->type == BP_PERCEPTRON){
+        perceptron.write(FP);
+    } else if(!long_history.data().empty()){
+        fwrite(&long_history.data()[0], 1, long_history.data().size(), FP);
+        fwrite(&long_history.position(), sizeof(size_t), 1, FP);
+    }
+    bool failed = ferror(FP) != 0;
+    failed = (fclose(FP) != 0) || failed;
+    if(failed || rename(tmp_file.c_str(), snapshot_file) != 0){
+        printf("Error: Unable to write file %s\n", snapshot_file);
+        exit(EXIT_FAILURE);
+    }
+}
+
+inline uint64_t BranchHistoryTable::load_snapshot(const char* snapshot_file, bool resume){
+    const bp_table tables[3] = {BP_TABLE_BIMODAL, BP_TABLE_GSHARE, BP_TABLE_CHOOSER};
+
+    FILE* FP = fopen(snapshot_file, "rb");
+    if(FP == NULL){
+        printf("Error: Unable to open file %s\n", snapshot_file);
+        exit(EXIT_FAILURE);
+    }
+
+    bp_snapshot_header header;
+    if(fread(&header, sizeof(header), 1, FP) != 1 || memcmp(header.magic, BP_SNAPSHOT_MAGIC, sizeof(BP_SNAPSHOT_MAGIC)) != 0 ||
+       header.version != BP_SNAPSHOT_VERSION){
+        printf("Error: Corrupt snapshot %s\n", snapshot_file);
+        exit(EXIT_FAILURE);
+    }
+
+    // The snapshot must come from the same predictor configuration
+    if(header.type != (uint32_t)this->type || header.K != bp_param.K || header.M1 != bp_param.M1 ||
+       header.M2 != bp_param.M2 || header.N != bp_param.N){
+        printf("Error: Snapshot %s was taken with different predictor parameters\n", snapshot_file);
+        exit(EXIT_FAILURE);
+    }
+
+    // The table words are the same in either backend, so a snapshot can be loaded into a sparse table
+    // from a dense one and the other way around
+    for(int t = 0; t < 3; t++){
+        bool ok = false;
+        with_table(tables[t], [&](auto& table){
+            ok = header.table_words[t] == table.num_words() && table.read(FP);
+        });
+        if(!ok){
+            printf("Error: Corrupt snapshot %s\n", snapshot_file);
+            exit(EXIT_FAILURE);
         }
     }
+    if((this->type == BP_TAGE && !tage.read(FP)) || (this->type == BP_PERCEPTRON && !perceptron.read(FP)) ||
+       (!long_history.data().empty() && (fread(&long_history.data()[0], 1, long_history.data().size(), FP) != long_history.data().size() ||
+                                         fread(&long_history.position(), sizeof(size_t), 1, FP) != 1))){
+        printf("Error: Corrupt snapshot %s\n", snapshot_file);
+        exit(EXIT_FAILURE);
+    }
+    fclose(FP);
+
+    this->global_history = header.global_history;
+    if(!resume){
+        return 0;
+    }
+    this->number_of_predictions = header.number_of_predictions;
+    this->number_of_mispredictions = header.number_of_mispredictions;
+    return header.trace_offset;
 }
 
 
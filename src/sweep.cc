@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include "sim_bp.h"
+#include "trace.h"
+#include "sweep.h"
+#include "cache.h"
+
+#define SWEEP_BATCH_SIZE    (1 << 16)   // branches per batch handed to the workers
+
+// One batch of branches shared by all workers
+typedef struct sweep_batch{
+    std::vector<uint64_t>           addr;
+    std::vector<char>               outcome;
+    size_t                          count;
+}sweep_batch;
+
+// Parse "v" or "lo-hi" into an inclusive range
+static void parse_range(const char* field, const char* spec, unsigned long int* lo, unsigned long int* hi){
+    char* end;
+    *lo = strtoul(field, &end, 10);
+    *hi = *lo;
+    if(*end == '-'){
+        *hi = strtoul(end + 1, &end, 10);
+    }
+    if(end == field || *end != '\0' || *hi < *lo){
+        printf("Error: Invalid sweep range '%s' in %s\n", field, spec);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void expand_sweep_spec(char* spec, std::vector<bp_params>& configs){
+    char* fields[5];
+    int num_fields = 0;
+    char copy[256];
+
+    snprintf(copy, sizeof(copy), "%s", spec);     // keep the original for error messages
+    for(char* p = strtok(spec, ":"); p != NULL; p = strtok(NULL, ":")){
+        if(num_fields == 5){
+            printf("Error: Invalid sweep spec %s\n", copy);
+            exit(EXIT_FAILURE);
+        }
+        fields[num_fields++] = p;
+    }
+
+    if(num_fields == 0){
+        printf("Error: Invalid sweep spec %s\n", copy);
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long int lo[4], hi[4];
+    bp_params params;
+    memset(&params, 0, sizeof(params));
+    params.bp_name = fields[0];
+
+    if(num_fields == 2 && strcmp(params.bp_name, "bimodal") == 0){
+        parse_range(fields[1], copy, &lo[0], &hi[0]);
+        for(params.M2 = lo[0]; params.M2 <= hi[0]; params.M2++){
+            configs.push_back(params);
+        }
+    } else if(num_fields == 3 && (strcmp(params.bp_name, "gshare") == 0 || strcmp(params.bp_name, "perceptron") == 0)){
+        parse_range(fields[1], copy, &lo[0], &hi[0]);
+        parse_range(fields[2], copy, &lo[1], &hi[1]);
+        for(params.M1 = lo[0]; params.M1 <= hi[0]; params.M1++){
+            for(params.N = lo[1]; params.N <= hi[1]; params.N++){
+                configs.push_back(params);
+            }
+        }
+    } else if(num_fields == 5 && (strcmp(params.bp_name, "hybrid") == 0 || strcmp(params.bp_name, "tage") == 0)){
+        for(int i = 0; i < 4; i++){
+            parse_range(fields[i + 1], copy, &lo[i], &hi[i]);
+        }
+        for(params.K = lo[0]; params.K <= hi[0]; params.K++){
+            for(params.M1 = lo[1]; params.M1 <= hi[1]; params.M1++){
+                for(params.N = lo[2]; params.N <= hi[2]; params.N++){
+                    for(params.M2 = lo[3]; params.M2 <= hi[3]; params.M2++){
+                        configs.push_back(params);
+                    }
+                }
+            }
+        }
+    } else {
+        printf("Error: Invalid sweep spec %s\n", copy);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void write_sweep_row(FILE* csv, const char* trace_file, const bp_params& p, uint64_t predictions, uint64_t mispredictions){
+    double misprediction_rate = (static_cast<double>(mispredictions) / static_cast<double>(predictions)) * 100;
+
+    fprintf(csv, "%s,%s,", trace_file, p.bp_name);
+    if(strcmp(p.bp_name, "bimodal") == 0){
+        fprintf(csv, ",,,%lu,", p.M2);
+    } else if(strcmp(p.bp_name, "gshare") == 0 || strcmp(p.bp_name, "perceptron") == 0){
+        fprintf(csv, ",%lu,%lu,,", p.M1, p.N);
+    } else {
+        fprintf(csv, "%lu,%lu,%lu,%lu,", p.K, p.M1, p.N, p.M2);
+    }
+    fprintf(csv, "%llu,%llu,%.2f\n", (unsigned long long)predictions, (unsigned long long)mispredictions, misprediction_rate);
+}
+
+// Run one batch through one predictor. The predictor kernel is picked once per batch, not per branch.
+static void run_batch(BranchHistoryTable& BHT, const sweep_batch& batch){
+    const uint64_t* addr = &batch.addr[0];
+    const char* outcome = &batch.outcome[0];
+
+    BHT.with_kernel([&](auto& kernel){
+        for(size_t i = 0; i < batch.count; i++){
+            kernel.step(addr[i], outcome[i] == 't');
+        }
+    });
+}
+
+void run_sweep_predictors(TraceReader& trace, const std::vector<BranchHistoryTable*>& predictors, uint64_t num_branches,
+                          size_t num_threads){
+    // Worker t owns predictors t, t + num_threads, t + 2 * num_threads, ...
+    if(num_threads == 0){
+        num_threads = std::thread::hardware_concurrency();
+    }
+    if(num_threads == 0){
+        num_threads = 1;
+    }
+    if(num_threads > predictors.size()){
+        num_threads = predictors.size();
+    }
+
+    // Double buffered batches: the reader fills one while the workers run the other
+    sweep_batch batches[2];
+    for(int i = 0; i < 2; i++){
+        batches[i].addr.resize(SWEEP_BATCH_SIZE);
+        batches[i].outcome.resize(SWEEP_BATCH_SIZE);
+        batches[i].count = 0;
+    }
+
+    std::mutex lock;
+    std::condition_variable batch_ready;    // signalled by the reader when a new batch is published
+    std::condition_variable batch_done;     // signalled by the last worker to finish a batch
+    long published = -1;                    // sequence number of the batch the workers should run
+    size_t finished = 0;                    // workers done with the published batch
+
+    std::vector<std::thread> workers;
+    for(size_t t = 0; t < num_threads; t++){
+        workers.push_back(std::thread([&, t](){
+            long seen = -1;
+            while(true){
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    batch_ready.wait(guard, [&](){ return published != seen; });
+                    seen = published;
+                }
+                const sweep_batch& batch = batches[seen & 1];
+                if(batch.count == 0){
+                    return;     // end of trace
+                }
+                for(size_t i = t; i < predictors.size(); i += num_threads){
+                    run_batch(*predictors[i], batch);
+                }
+                std::unique_lock<std::mutex> guard(lock);
+                if(++finished == num_threads){
+                    batch_done.notify_one();
+                }
+            }
+        }));
+    }
+
+    // Read a batch from the trace into batches[index], stopping after num_branches
+    uint64_t remaining = num_branches;
+    auto fill = [&](int index){
+        sweep_batch& batch = batches[index];
+        batch.count = 0;
+        remaining -= trace.run(std::min<uint64_t>(SWEEP_BATCH_SIZE, remaining), [&](uint64_t addr, char outcome){
+            batch.addr[batch.count] = addr;
+            batch.outcome[batch.count] = outcome;
+            batch.count++;
+        });
+    };
+
+    fill(0);
+    for(long seq = 0; ; seq++){
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            finished = 0;
+            published = seq;
+        }
+        batch_ready.notify_all();
+        if(batches[seq & 1].count == 0){
+            break;
+        }
+
+        fill((seq + 1) & 1);
+
+        std::unique_lock<std::mutex> guard(lock);
+        batch_done.wait(guard, [&](){ return finished == num_threads; });
+    }
+    for(size_t t = 0; t < workers.size(); t++){
+        workers[t].join();
+    }
+}
+
+int run_sweep(const char* trace_file, const char* csv_file, int num_specs, char* specs[], const char* cache_dir){
+    std::vector<bp_params> configs;
+    for(int i = 0; i < num_specs; i++){
+        expand_sweep_spec(specs[i], configs);
+    }
+    if(configs.empty()){
+        printf("Error: Sweep has no configurations\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The cache is opened first, so a trace it cannot be used with is rejected before the CSV is created
+    ResultCache* cache = (cache_dir != NULL) ? new ResultCache(cache_dir, trace_file) : NULL;
+
+    FILE* csv = fopen(csv_file, "w");
+    if(csv == NULL){
+        printf("Error: Unable to open file %s\n", csv_file);
+        exit(EXIT_FAILURE);
+    }
+
+    // Only the configurations missing from the cache are simulated; simulated[i] is NULL for a cached one
+    std::vector<uint64_t> cached_predictions(configs.size()), cached_mispredictions(configs.size());
+    std::vector<BranchHistoryTable*> simulated(configs.size(), NULL);
+    std::vector<BranchHistoryTable*> predictors;
+    for(size_t i = 0; i < configs.size(); i++){
+        if(cache == NULL || !cache->lookup(configs[i], &cached_predictions[i], &cached_mispredictions[i])){
+            simulated[i] = new BranchHistoryTable(configs[i]);
+            predictors.push_back(simulated[i]);
+        }
+    }
+
+    if(!predictors.empty()){
+        TraceReader trace;
+        if(!trace.open(trace_file)){
+            printf("Error: Unable to open file %s\n", trace_file);
+            exit(EXIT_FAILURE);
+        }
+        run_sweep_predictors(trace, predictors, UINT64_MAX);
+    }
+
+    // Write the results
+    fprintf(csv, SWEEP_CSV_HEADER);
+    for(size_t i = 0; i < configs.size(); i++){
+        if(simulated[i] == NULL){
+            write_sweep_row(csv, trace_file, configs[i], cached_predictions[i], cached_mispredictions[i]);
+            continue;
+        }
+        BranchHistoryTable& BHT = *simulated[i];
+        write_sweep_row(csv, trace_file, BHT.bp_param, BHT.number_of_predictions, BHT.number_of_mispredictions);
+        if(cache != NULL){
+            cache->store(BHT.bp_param, BHT.number_of_predictions, BHT.number_of_mispredictions);
+        }
+        delete simulated[i];
+    }
+    delete cache;
+
+    if(fclose(csv) != 0){
+        printf("Error: Unable to write file %s\n", csv_file);
+        exit(EXIT_FAILURE);
+    }
+    return (int)configs.size();
+}
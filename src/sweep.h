@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include "sim_bp.h"
+#include "trace.h"
+#ifndef SWEEP_H
+#define SWEEP_H
+
+/*  Single-pass multi-configuration sweep ("sim sweep")
+
+    Every configuration described by specs is simulated against one read of trace_file. The trace is
+    read in fixed-size batches by the calling thread, and each batch is handed to all worker threads,
+    which each own a shard of the configurations and run them in lockstep. One CSV row is written to
+    csv_file per configuration.
+
+    spec:   bimodal:M2
+            gshare:M1:N
+            perceptron:M1:N
+            hybrid:K:M1:N:M2
+            tage:K:M1:N:M2
+    Every field is either a single value or an inclusive range lo-hi, e.g. gshare:7-20:0-20 expands to
+    every (M1, N) pair with 7 <= M1 <= 20 and 0 <= N <= 20, including those with N > M1 (a long history,
+    folded down to M1 bits). The spec strings are tokenized in place.
+
+    With cache_dir, configurations found in the result cache (see cache.h) are not simulated again, and the
+    results of the others are added to it.
+*/
+int run_sweep(const char* trace_file, const char* csv_file, int num_specs, char* specs[], const char* cache_dir);
+
+// Run the next num_branches branches of trace (or up to its end) through every predictor, in lockstep on
+// num_threads worker threads (0 for one per core), the way run_sweep does
+void run_sweep_predictors(TraceReader& trace, const std::vector<BranchHistoryTable*>& predictors, uint64_t num_branches,
+                          size_t num_threads = 0);
+
+// Expand one spec into the list of configurations it describes; exits on a malformed spec
+void expand_sweep_spec(char* spec, std::vector<bp_params>& configs);
+
+// Result CSV shared by sweep and batch: the header line, and one row per simulated configuration
+#define SWEEP_CSV_HEADER    "trace,predictor,K,M1,N,M2,num_predictions,num_mispredictions,misprediction_rate\n"
+void write_sweep_row(FILE* csv, const char* trace_file, const bp_params& p, uint64_t predictions, uint64_t mispredictions);
+
+#endif
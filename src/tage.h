@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include "history.h"
+#ifndef TAGE_H
+#define TAGE_H
+
+/*  TAGE tagged components ("sim tage K M1 N M2")
+
+    K tagged tables of 2^M1 entries each, indexed and tagged with a hash of the PC and the newest L(i)
+    global history bits, where the history lengths grow geometrically from TAGE_MIN_HISTORY to N:
+        L(i) = TAGE_MIN_HISTORY * (N / TAGE_MIN_HISTORY)^(i / (K - 1)),   i = 0 .. K-1
+    The base predictor is the branch history table's bimodal table (2^M2 entries).
+
+    Each entry is 16 bits (3-bit counter, 2-bit useful counter, 11-bit tag), so one 64-byte cache line
+    holds 32 entries and a lookup touches exactly one line per table. The K tables share one array, and
+    all K lines are prefetched as soon as the indices are known, before any of them is needed, so the
+    misses of the K lookups overlap instead of adding up.
+
+    Tag 0 marks an entry that was never allocated (a branch whose tag hashes to 0 uses tag 1), so only
+    allocated entries can hit. The prediction comes from the hitting table with the longest history (the
+    provider), or from the next one (the alternate) when the provider's entry was just allocated and
+    use_alt_on_na says newly allocated entries are currently worse than the alternate. On a misprediction
+    one entry is allocated in a table with a longer history than the provider's. Every useful counter is
+    halved once every TAGE_U_RESET_PERIOD branches, a small slice of the tables per branch rather than all
+    of them at once.
+*/
+#define TAGE_MAX_TABLES         16
+#define TAGE_MIN_HISTORY        4
+#define TAGE_TAG_BITS           11
+#define TAGE_U_RESET_PERIOD     (1UL << 18)
+
+// Entry layout: bits 0-2 prediction counter (taken if >= 4), bits 3-4 useful counter, bits 5-15 tag
+#define TAGE_CTR_MASK           0x0007
+#define TAGE_U_SHIFT            3
+#define TAGE_U_MASK             0x0018
+#define TAGE_TAG_SHIFT          5
+#define TAGE_ENTRY_INIT         4           // weakly taken, not useful, tag 0: empty
+
+class tage_predictor{
+public:
+    tage_predictor() : num_tables(0), index_bits(0), use_alt_on_na(8), branches(0), seed(0x2545f491) {}
+
+    // Whether init accepts the parameters
+    static bool valid_params(unsigned long int num_tables, unsigned long int index_bits, unsigned long int max_history){
+        return num_tables >= 1 && num_tables <= TAGE_MAX_TABLES && index_bits >= 1 && index_bits <= 24 &&
+               max_history >= TAGE_MIN_HISTORY;
+    }
+
+    void init(unsigned long int num_tables, unsigned long int index_bits, unsigned long int max_history){
+        if(!valid_params(num_tables, index_bits, max_history)){
+            printf("Error: Invalid tage parameters K=%lu M1=%lu N=%lu (1 <= K <= %d, 1 <= M1 <= 24, N >= %d)\n",
+                   num_tables, index_bits, max_history, TAGE_MAX_TABLES, TAGE_MIN_HISTORY);
+            exit(EXIT_FAILURE);
+        }
+        this->num_tables = (unsigned int)num_tables;
+        this->index_bits = (unsigned int)index_bits;
+        entries.assign(num_tables << index_bits, TAGE_ENTRY_INIT);
+        history.resize(max_history);
+        for(unsigned int i = 0; i < num_tables; i++){
+            double ratio = (num_tables > 1) ? (double)i / (num_tables - 1) : 1;
+            lengths[i] = (uint32_t)(TAGE_MIN_HISTORY * pow((double)max_history / TAGE_MIN_HISTORY, ratio) + 0.5);
+            pc_shift[i] = this->index_bits - i % this->index_bits;
+            table_base[i] = (size_t)i << this->index_bits;
+            index_fold[i].init(lengths[i], this->index_bits);
+            tag_fold[0][i].init(lengths[i], TAGE_TAG_BITS);
+            tag_fold[1][i].init(lengths[i], TAGE_TAG_BITS - 1);
+        }
+    }
+
+    // Predict the branch at addr, then train on its actual outcome. base is the bimodal table and base_index
+    // the branch's index into it. Returns the prediction.
+    template<class Table>
+    bool step(Table& base, unsigned long int base_index, uint64_t addr, bool taken){
+        tage_lookup l;
+        bool prediction = lookup(base, base_index, addr, l);
+        unsigned int n = num_tables;
+
+        // Step 4: Allocate an entry in a longer-history table on a misprediction
+        if(prediction != taken && l.provider < (int)n - 1){
+            allocate(l.index, l.tag, l.provider + 1, taken);
+        }
+
+        // Step 5: Update the provider, and the alternate if the provider's entry is newly allocated
+        if(l.provider >= 0){
+            uint16_t& entry = entries[l.index[l.provider]];
+            if(l.newly_allocated && l.provider_prediction != l.alt_prediction){
+                use_alt_on_na += (l.alt_prediction == taken) ? (use_alt_on_na < 15) : -(use_alt_on_na > 0);
+            }
+            if(l.provider_prediction != l.alt_prediction){
+                unsigned int u = (entry & TAGE_U_MASK) >> TAGE_U_SHIFT;
+                u = (l.provider_prediction == taken) ? u + (u < 3) : u - (u > 0);
+                entry = (uint16_t)((entry & ~TAGE_U_MASK) | (u << TAGE_U_SHIFT));
+            }
+            entry = counter_update(entry, taken);
+            if(l.newly_allocated){
+                if(l.alternate >= 0){
+                    entries[l.index[l.alternate]] = counter_update(entries[l.index[l.alternate]], taken);
+                } else {
+                    base.update(base_index, taken);
+                }
+            }
+        } else {
+            base.update(base_index, taken);
+        }
+
+        // Step 6: Age the useful counters, one slice per branch: entry i is halved once per period, at the
+        // point of the period proportional to i, so no single branch pays for a pass over every table
+        uint64_t size = entries.size();
+        size_t first = (size_t)(branches % TAGE_U_RESET_PERIOD * size / TAGE_U_RESET_PERIOD);
+        size_t phase = (size_t)(++branches % TAGE_U_RESET_PERIOD);
+        size_t last = (phase == 0) ? (size_t)size : (size_t)(phase * size / TAGE_U_RESET_PERIOD);
+        for(size_t i = first; i < last; i++){
+            uint16_t u = (entries[i] & TAGE_U_MASK) >> (TAGE_U_SHIFT + 1);
+            entries[i] = (uint16_t)((entries[i] & ~TAGE_U_MASK) | (u << TAGE_U_SHIFT));
+        }
+
+        // Step 7: Update the global history and every folded copy of it
+        // (the outgoing bits are all read first, so the byte store into the history buffer is not reloaded per fold)
+        history.push(taken);
+        bool oldest[TAGE_MAX_TABLES];
+        for(unsigned int i = 0; i < n; i++){
+            oldest[i] = history[lengths[i]];
+        }
+        for(unsigned int i = 0; i < n; i++){
+            index_fold[i].update(taken, oldest[i]);
+            tag_fold[0][i].update(taken, oldest[i]);
+            tag_fold[1][i].update(taken, oldest[i]);
+        }
+        return prediction;
+    }
+
+    // The prediction step() would make, without changing any state
+    template<class Table>
+    bool predict(const Table& base, unsigned long int base_index, uint64_t addr) const {
+        tage_lookup l;
+        return lookup(base, base_index, addr, l);
+    }
+
+    // Raw state, for snapshots: the entries, then the history, then the remaining registers
+    void write(FILE* FP){
+        fwrite(&entries[0], sizeof(uint16_t), entries.size(), FP);
+        fwrite(&history.data()[0], 1, history.data().size(), FP);
+        fwrite(&history.position(), sizeof(size_t), 1, FP);
+        fwrite(index_fold, sizeof(folded_history), num_tables, FP);
+        fwrite(tag_fold[0], sizeof(folded_history), num_tables, FP);
+        fwrite(tag_fold[1], sizeof(folded_history), num_tables, FP);
+        fwrite(&use_alt_on_na, sizeof(use_alt_on_na), 1, FP);
+        fwrite(&branches, sizeof(branches), 1, FP);
+        fwrite(&seed, sizeof(seed), 1, FP);
+    }
+
+    bool read(FILE* FP){
+        return fread(&entries[0], sizeof(uint16_t), entries.size(), FP) == entries.size() &&
+               fread(&history.data()[0], 1, history.data().size(), FP) == history.data().size() &&
+               fread(&history.position(), sizeof(size_t), 1, FP) == 1 &&
+               fread(index_fold, sizeof(folded_history), num_tables, FP) == num_tables &&
+               fread(tag_fold[0], sizeof(folded_history), num_tables, FP) == num_tables &&
+               fread(tag_fold[1], sizeof(folded_history), num_tables, FP) == num_tables &&
+               fread(&use_alt_on_na, sizeof(use_alt_on_na), 1, FP) == 1 &&
+               fread(&branches, sizeof(branches), 1, FP) == 1 &&
+               fread(&seed, sizeof(seed), 1, FP) == 1;
+    }
+
+private:
+    // Everything step() needs to know about a branch after predicting it
+    typedef struct tage_lookup{
+        size_t      index[TAGE_MAX_TABLES];
+        uint32_t    tag[TAGE_MAX_TABLES];
+        int         provider;                   // longest matching table, or -1
+        int         alternate;                  // next longest matching table, or -1
+        bool        alt_prediction;
+        bool        provider_prediction;
+        bool        newly_allocated;            // the provider's entry has not proven itself yet
+    }tage_lookup;
+
+    // Hash the indices and tags of the branch at addr, find its provider and alternate, and return the prediction
+    template<class Table>
+    bool lookup(const Table& base, unsigned long int base_index, uint64_t addr, tage_lookup& l) const {
+        uint64_t pc = addr >> 2;
+        size_t mask = ((size_t)1 << index_bits) - 1;
+        unsigned int n = num_tables;
+
+        // Step 1: Hash every table's index and start loading its cache line
+        for(unsigned int i = 0; i < n; i++){
+            l.index[i] = table_base[i] | ((pc ^ (pc >> pc_shift[i]) ^ index_fold[i].value) & mask);
+            __builtin_prefetch(&entries[l.index[i]]);
+        }
+        // Tag 0 marks an entry that was never allocated: a hash of 0 becomes 1, so a cold entry never hits
+        for(unsigned int i = 0; i < n; i++){
+            uint32_t tag = (uint32_t)(pc ^ tag_fold[0][i].value ^ (tag_fold[1][i].value << 1)) & ((1U << TAGE_TAG_BITS) - 1);
+            l.tag[i] = tag | (tag == 0);
+        }
+
+        // Step 2: Find the provider (longest matching history) and the alternate (next longest)
+        l.provider = -1;
+        l.alternate = -1;
+        for(int i = (int)n - 1; i >= 0; i--){
+            if((entries[l.index[i]] >> TAGE_TAG_SHIFT) == l.tag[i]){
+                if(l.provider < 0){
+                    l.provider = i;
+                } else {
+                    l.alternate = i;
+                    break;
+                }
+            }
+        }
+
+        // Step 3: Make the prediction
+        bool base_prediction = base.predict(base_index);
+        l.alt_prediction = (l.alternate >= 0) ? counter_predict(entries[l.index[l.alternate]]) : base_prediction;
+        l.provider_prediction = l.alt_prediction;
+        l.newly_allocated = false;
+        if(l.provider < 0){
+            return l.alt_prediction;
+        }
+        uint16_t entry = entries[l.index[l.provider]];
+        l.provider_prediction = counter_predict(entry);
+        unsigned int ctr = entry & TAGE_CTR_MASK;
+        l.newly_allocated = (ctr == 3 || ctr == 4) && (entry & TAGE_U_MASK) == 0;
+        return (l.newly_allocated && use_alt_on_na >= 8) ? l.alt_prediction : l.provider_prediction;
+    }
+
+    static bool counter_predict(uint16_t entry){
+        return (entry & TAGE_CTR_MASK) >= 4;
+    }
+
+    static uint16_t counter_update(uint16_t entry, bool taken){
+        unsigned int ctr = entry & TAGE_CTR_MASK;
+        ctr = taken ? ctr + (ctr < 7) : ctr - (ctr > 0);
+        return (uint16_t)((entry & ~TAGE_CTR_MASK) | ctr);
+    }
+
+    // Claim a not-useful entry in one of the tables from first on (skipping the first candidate half the time,
+    // so that allocations spread over the tables). If every candidate is useful, age them all instead.
+    void allocate(const size_t* index, const uint32_t* tag, unsigned int first, bool taken){
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        bool skip = seed & 1;
+        int chosen = -1;
+        for(unsigned int i = first; i < num_tables; i++){
+            if((entries[index[i]] & TAGE_U_MASK) == 0){
+                chosen = i;
+                if(!skip){
+                    break;
+                }
+                skip = false;
+            }
+        }
+        if(chosen < 0){
+            for(unsigned int i = first; i < num_tables; i++){
+                if(entries[index[i]] & TAGE_U_MASK){
+                    entries[index[i]] = (uint16_t)(entries[index[i]] - (1 << TAGE_U_SHIFT));
+                }
+            }
+            return;
+        }
+        entries[index[chosen]] = (uint16_t)((tag[chosen] << TAGE_TAG_SHIFT) | (taken ? 4 : 3));
+    }
+
+    unsigned int            num_tables;
+    unsigned int            index_bits;
+    std::vector<uint16_t>   entries;                        // table i is entries[i << index_bits ...]
+    uint32_t                lengths[TAGE_MAX_TABLES];       // history length of each table
+    unsigned int            pc_shift[TAGE_MAX_TABLES];      // PC bits folded onto themselves in each table's index
+    size_t                  table_base[TAGE_MAX_TABLES];    // offset of each table in entries
+    history_buffer          history;
+    folded_history          index_fold[TAGE_MAX_TABLES];    // history folded to index_bits
+    folded_history          tag_fold[2][TAGE_MAX_TABLES];   // history folded to TAGE_TAG_BITS and TAGE_TAG_BITS - 1
+    int                     use_alt_on_na;                  // >= 8: trust the alternate over newly allocated entries
+    uint64_t                branches;
+    uint32_t                seed;                           // xorshift32 state for allocation
+};
+
+#endif
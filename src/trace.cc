@@ -0,0 +1,545 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "trace.h"
+
+/*  Text trace parser thread
+
+    The parser thread owns the text input (a file, stdin, or the output pipe of a decompressor) and is the
+    only producer of the ring; the simulator thread calling TraceReader::run() is the only consumer. head
+    and tail only ever grow, slot i % TRACE_RING_SLOTS holds batch i, and each side publishes its progress
+    with a release store that the other side reads with an acquire load, so no locks are needed.
+*/
+struct trace_stream{
+    FILE*                   FP;
+    pid_t                   decompressor;   // -1 if FP is read directly
+    char                    name[256];      // for error messages
+    std::thread             parser;
+    std::atomic<long>       parser_tid;     // set by the parser thread when it starts (Linux only)
+    std::atomic<bool>       stop;           // set by the consumer to abandon the trace early
+    std::atomic<bool>       held;           // the parser waits for the consumer to clear this before reading
+    std::atomic<size_t>     head;           // batches produced
+    std::atomic<size_t>     tail;           // batches consumed
+    bool                    ended;          // consumer has seen the end-of-trace batch
+    trace_batch             slots[TRACE_RING_SLOTS];
+};
+
+// Buffered character reader for the parser thread
+typedef struct text_input{
+    FILE*           FP;
+    unsigned char   buffer[1 << 16];
+    size_t          used;
+    size_t          size;
+}text_input;
+
+static inline int next_char(text_input& in){
+    if(in.used == in.size){
+        in.size = fread(in.buffer, 1, sizeof(in.buffer), in.FP);
+        in.used = 0;
+        if(in.size == 0){
+            return EOF;
+        }
+    }
+    return in.buffer[in.used++];
+}
+
+static inline bool is_space(int c){
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline int skip_space(text_input& in){
+    int c = next_char(in);
+    while(is_space(c)){
+        c = next_char(in);
+    }
+    return c;
+}
+
+static inline int hex_value(int c){
+    if(c >= '0' && c <= '9'){
+        return c - '0';
+    } else if(c >= 'a' && c <= 'f'){
+        return c - 'a' + 10;
+    } else if(c >= 'A' && c <= 'F'){
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+enum parse_status{
+    PARSE_RECORD,
+    PARSE_END,
+    PARSE_MALFORMED
+};
+
+// Parse one "<hex pc> <outcome>" record, accepting the same input as fscanf("%lx %s"). The outcome is the
+// first character of the second token; the rest of the token is skipped.
+static parse_status parse_record(text_input& in, uint64_t* addr, char* outcome){
+    int c = skip_space(in);
+    int pending = EOF;      // character read past "0" while looking for an "0x" prefix
+
+    if(c == EOF){
+        return PARSE_END;
+    }
+
+    if(c == '0'){
+        c = next_char(in);
+        if(c == 'x' || c == 'X'){
+            c = next_char(in);
+        } else {
+            pending = c;
+            c = '0';
+        }
+    }
+    if(hex_value(c) < 0){
+        return PARSE_MALFORMED;
+    }
+
+    // More than 16 significant digits do not fit in 64 bits; reject them instead of wrapping
+    uint64_t value = 0;
+    int digits = 0;
+    while(hex_value(c) >= 0){
+        value = (value << 4) | hex_value(c);
+        digits += (digits != 0 || hex_value(c) != 0);
+        if(digits > 16){
+            return PARSE_MALFORMED;
+        }
+        if(pending != EOF){
+            c = pending;
+            pending = EOF;
+        } else {
+            c = next_char(in);
+        }
+    }
+
+    while(is_space(c)){
+        c = next_char(in);
+    }
+    if(c == EOF){
+        return PARSE_MALFORMED;
+    }
+    *addr = value;
+    *outcome = (char)c;
+    while(c != EOF && !is_space(c)){
+        c = next_char(in);
+    }
+    return PARSE_RECORD;
+}
+
+static void parse_trace(trace_stream* stream){
+#ifdef __linux__
+    stream->parser_tid.store((long)syscall(SYS_gettid), std::memory_order_release);
+#endif
+    while(stream->held.load(std::memory_order_acquire)){
+        if(stream->stop.load(std::memory_order_relaxed)){
+            return;
+        }
+        std::this_thread::yield();
+    }
+    text_input* in = new text_input;
+    in->FP = stream->FP;
+    in->used = 0;
+    in->size = 0;
+
+    bool more = true;
+    uint64_t num_branches = 0;
+    size_t head = stream->head.load(std::memory_order_relaxed);
+    while(true){
+        // Wait for a free slot
+        while(head - stream->tail.load(std::memory_order_acquire) == TRACE_RING_SLOTS){
+            if(stream->stop.load(std::memory_order_relaxed)){
+                delete in;
+                return;
+            }
+            std::this_thread::yield();
+        }
+
+        trace_batch& batch = stream->slots[head % TRACE_RING_SLOTS];
+        batch.count = 0;
+        while(more && batch.count < TRACE_BATCH_SIZE){
+            char& outcome = batch.outcome[batch.count];
+            parse_status status = parse_record(*in, &batch.addr[batch.count], &outcome);
+            if(status == PARSE_MALFORMED){
+                printf("Error: Malformed branch record at branch %llu of %s\n", (unsigned long long)num_branches, stream->name);
+                exit(EXIT_FAILURE);
+            } else if(status == PARSE_RECORD && outcome != 't' && outcome != 'n'){
+                printf("Error: Invalid branch outcome '%c' at branch %llu of %s\n", outcome, (unsigned long long)num_branches, stream->name);
+                exit(EXIT_FAILURE);
+            }
+            more = status == PARSE_RECORD;
+            batch.count += more;
+            num_branches += more;
+        }
+        stream->head.store(++head, std::memory_order_release);
+
+        if(batch.count == 0 || stream->stop.load(std::memory_order_relaxed)){
+            break;      // the empty batch marks the end of the trace
+        }
+    }
+    delete in;
+
+    // A decompressor that failed (corrupt input, tool not installed) shows up as a short trace; report it
+    if(stream->decompressor > 0 && !stream->stop.load(std::memory_order_relaxed)){
+        int status = 0;
+        fclose(stream->FP);
+        stream->FP = NULL;
+        waitpid(stream->decompressor, &status, 0);
+        stream->decompressor = -1;
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+            printf("Error: Unable to decompress file %s\n", stream->name);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Start tool -dc on trace_file and return the read end of its stdout
+static FILE* spawn_decompressor(const char* tool, const char* trace_file, pid_t* pid){
+    int fds[2];
+    if(pipe(fds) != 0){
+        return NULL;
+    }
+    *pid = fork();
+    if(*pid < 0){
+        ::close(fds[0]);
+        ::close(fds[1]);
+        return NULL;
+    }
+    if(*pid == 0){
+        dup2(fds[1], STDOUT_FILENO);
+        ::close(fds[0]);
+        ::close(fds[1]);
+        execlp(tool, tool, "-dc", trace_file, (char*)NULL);
+        _exit(127);
+    }
+    ::close(fds[1]);
+    return fdopen(fds[0], "r");
+}
+
+// Pick the decompressor for a file from its magic bytes, or NULL for plain text
+static const char* decompressor_for(const unsigned char* magic, size_t size){
+    if(size >= 2 && magic[0] == 0x1f && magic[1] == 0x8b){
+        return "gzip";
+    } else if(size >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd){
+        return "zstd";
+    } else if(size >= 6 && memcmp(magic, "\xfd" "7zXZ\0", 6) == 0){
+        return "xz";
+    } else if(size >= 3 && memcmp(magic, "BZh", 3) == 0){
+        return "bzip2";
+    }
+    return NULL;
+}
+
+TraceReader::TraceReader(){
+    this->stream = NULL;
+    this->batch = NULL;
+    this->batch_pos = 0;
+    this->map = NULL;
+    this->map_size = 0;
+    this->header = NULL;
+    this->outcome_bits = NULL;
+    this->num_branches = 0;
+    this->pos = 0;
+}
+
+TraceReader::~TraceReader(){
+    close();
+}
+
+bool TraceReader::open(const char* trace_file, bool hold_parser){
+    close();
+
+    FILE* FP = NULL;
+    pid_t decompressor = -1;
+
+    if(strcmp(trace_file, "-") == 0){
+        FP = stdin;
+    } else {
+        int fd = ::open(trace_file, O_RDONLY);
+        if(fd < 0){
+            return false;
+        }
+
+        // Sniff the magic to decide between the binary, compressed and text formats
+        unsigned char magic[sizeof(((bp_trace_header*)0)->magic)];
+        struct stat st;
+        ssize_t magic_size = pread(fd, magic, sizeof(magic), 0);
+        if(magic_size < 0){
+            magic_size = 0;
+        }
+        bool binary = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (size_t)st.st_size >= sizeof(bp_trace_header) &&
+                      magic_size == (ssize_t)sizeof(magic) && memcmp(magic, BP_TRACE_MAGIC, sizeof(BP_TRACE_MAGIC)) == 0;
+
+        if(binary){
+            void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if(addr == MAP_FAILED){
+                return false;
+            }
+            madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+            this->map = (const unsigned char*)addr;
+            this->map_size = st.st_size;
+            this->header = (const bp_trace_header*)addr;
+
+            // Validate the header against the size of the mapping before trusting any offsets in it. Both
+            // arrays are read in place, so their offsets must also be aligned to their element size.
+            uint64_t n = header->num_branches;
+            if(header->version != BP_TRACE_VERSION || (header->pc_bytes != 4 && header->pc_bytes != 8) ||
+               header->pc_offset % header->pc_bytes != 0 ||
+               header->pc_offset > map_size || n > (map_size - header->pc_offset) / header->pc_bytes ||
+               header->outcome_offset % 8 != 0 || header->outcome_offset > map_size ||
+               (n + 63) / 64 > (map_size - header->outcome_offset) / 8){
+                printf("Error: Corrupt binary trace %s\n", trace_file);
+                exit(EXIT_FAILURE);
+            }
+
+            this->outcome_bits = (const uint64_t*)(map + header->outcome_offset);
+            this->num_branches = n;
+            return true;
+        }
+
+        const char* tool = decompressor_for(magic, magic_size);
+        if(tool != NULL){
+            ::close(fd);
+            FP = spawn_decompressor(tool, trace_file, &decompressor);
+        } else {
+            FP = fdopen(fd, "r");
+            if(FP == NULL){
+                ::close(fd);
+            }
+        }
+        if(FP == NULL){
+            return false;
+        }
+    }
+
+    // Start the parser thread
+    this->stream = new trace_stream;
+    stream->FP = FP;
+    stream->decompressor = decompressor;
+    snprintf(stream->name, sizeof(stream->name), "%s", trace_file);
+    stream->stop.store(false);
+    stream->held.store(hold_parser);
+    stream->head.store(0);
+    stream->tail.store(0);
+    stream->ended = false;
+    stream->parser_tid.store(0);
+    stream->parser = std::thread(parse_trace, stream);
+    return true;
+}
+
+long TraceReader::parser_thread_id() const {
+    if(this->stream == NULL){
+        return 0;
+    }
+#ifdef __linux__
+    while(stream->parser_tid.load(std::memory_order_acquire) == 0){
+        std::this_thread::yield();
+    }
+#endif
+    return stream->parser_tid.load(std::memory_order_acquire);
+}
+
+void TraceReader::release_parser(){
+    if(this->stream != NULL){
+        stream->held.store(false, std::memory_order_release);
+    }
+}
+
+bool TraceReader::next_batch(){
+    if(stream->ended){
+        return false;
+    }
+
+    // Hand the finished batch back to the parser
+    size_t tail = stream->tail.load(std::memory_order_relaxed);
+    if(this->batch != NULL){
+        stream->tail.store(++tail, std::memory_order_release);
+        this->batch = NULL;
+    }
+
+    // Wait for the next one
+    while(stream->head.load(std::memory_order_acquire) == tail){
+        std::this_thread::yield();
+    }
+    this->batch = &stream->slots[tail % TRACE_RING_SLOTS];
+    this->batch_pos = 0;
+    if(this->batch->count == 0){
+        stream->ended = true;
+        return false;
+    }
+    return true;
+}
+
+void TraceReader::close(){
+    if(this->stream != NULL){
+        // Stop the parser (it may be waiting for a free slot) and release the input
+        stream->stop.store(true);
+        stream->parser.join();
+        if(stream->FP != NULL && stream->FP != stdin){
+            fclose(stream->FP);
+        }
+        if(stream->decompressor > 0){
+            waitpid(stream->decompressor, NULL, 0);
+        }
+        delete stream;
+    }
+    if(this->map != NULL){
+        munmap((void*)this->map, this->map_size);
+    }
+    this->stream = NULL;
+    this->batch = NULL;
+    this->batch_pos = 0;
+    this->map = NULL;
+    this->map_size = 0;
+    this->header = NULL;
+    this->outcome_bits = NULL;
+    this->num_branches = 0;
+    this->pos = 0;
+}
+
+TraceWriter::TraceWriter(){
+    this->FP = NULL;
+    this->name = NULL;
+    this->pc_bytes = 0;
+    this->num_branches = 0;
+    this->block_used = 0;
+}
+
+TraceWriter::~TraceWriter(){
+    if(this->FP != NULL){
+        fclose(this->FP);
+    }
+}
+
+void TraceWriter::open(const char* trace_file, uint32_t pc_bytes){
+    this->FP = fopen(trace_file, "wb");
+    if(this->FP == NULL){
+        printf("Error: Unable to open file %s\n", trace_file);
+        exit(EXIT_FAILURE);
+    }
+    this->name = trace_file;
+    this->pc_bytes = pc_bytes;
+    this->num_branches = 0;
+    this->outcome_bits.clear();
+    this->block.resize(1 << 16);
+    this->block_used = 0;
+
+    // The header is rewritten by close() once the number of branches is known
+    bp_trace_header header;
+    memset(&header, 0, sizeof(header));
+    fwrite(&header, sizeof(header), 1, this->FP);
+}
+
+void TraceWriter::flush(){
+    fwrite(&block[0], 1, block_used, FP);
+    block_used = 0;
+}
+
+void TraceWriter::write(uint64_t addr, bool taken){
+    if(block_used + pc_bytes > block.size()){
+        flush();
+    }
+    if(pc_bytes == 4){
+        uint32_t pc = (uint32_t)addr;
+        memcpy(&block[block_used], &pc, 4);
+    } else {
+        uint64_t pc = addr;
+        memcpy(&block[block_used], &pc, 8);
+    }
+    block_used += pc_bytes;
+
+    if((num_branches & 63) == 0){
+        outcome_bits.push_back(0);
+    }
+    outcome_bits.back() |= (uint64_t)taken << (num_branches & 63);
+    num_branches++;
+}
+
+uint64_t TraceWriter::close(){
+    flush();
+
+    bp_trace_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BP_TRACE_MAGIC, sizeof(BP_TRACE_MAGIC));
+    header.version = BP_TRACE_VERSION;
+    header.pc_bytes = pc_bytes;
+    header.num_branches = num_branches;
+    header.pc_offset = sizeof(bp_trace_header);
+    header.outcome_offset = (header.pc_offset + num_branches * pc_bytes + 7) & ~(uint64_t)7;
+
+    // Pad up to the outcome bitmap, then go back and fill in the header
+    static const unsigned char padding[8] = {0};
+    fwrite(padding, 1, header.outcome_offset - (header.pc_offset + num_branches * pc_bytes), FP);
+    if(!outcome_bits.empty()){
+        fwrite(&outcome_bits[0], sizeof(uint64_t), outcome_bits.size(), FP);
+    }
+    bool failed = fseek(FP, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, FP) != 1 || ferror(FP) != 0;
+    failed = (fclose(FP) != 0) || failed;
+    FP = NULL;
+    if(failed){
+        printf("Error: Unable to write file %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+    return num_branches;
+}
+
+uint64_t convert_trace(const char* text_file, const char* binary_file){
+    FILE* in = fopen(text_file, "r");
+    if(in == NULL){
+        printf("Error: Unable to open file %s\n", text_file);
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t addr;
+    char str[2];
+
+    // Pass 1: validate the outcomes and find the widest PC to pick the PC width. The outcome is the first
+    // character of its token and the rest of the token is skipped.
+    uint64_t num_branches = 0;
+    uint64_t max_addr = 0;
+    int fields;
+    while((fields = fscanf(in, "%" SCNx64 " %1s%*[^ \t\n\r\v\f]", &addr, str)) == 2){
+        if(str[0] != 't' && str[0] != 'n'){
+            printf("Error: Invalid branch outcome '%c' at branch %llu of %s\n", str[0], (unsigned long long)num_branches, text_file);
+            exit(EXIT_FAILURE);
+        }
+        if(addr > max_addr){
+            max_addr = addr;
+        }
+        num_branches++;
+    }
+    if(fields != EOF){
+        printf("Error: Malformed branch record at branch %llu of %s\n", (unsigned long long)num_branches, text_file);
+        exit(EXIT_FAILURE);
+    }
+
+    // Pass 2: write the branches
+    TraceWriter out;
+    out.open(binary_file, (max_addr > 0xffffffffUL) ? 8 : 4);
+    rewind(in);
+    uint64_t i = 0;
+    while(i < num_branches && fscanf(in, "%" SCNx64 " %1s%*[^ \t\n\r\v\f]", &addr, str) == 2){
+        out.write(addr, str[0] == 't');
+        i++;
+    }
+    fclose(in);
+
+    if(i != num_branches){
+        printf("Error: Unable to read file %s\n", text_file);
+        exit(EXIT_FAILURE);
+    }
+    return out.close();
+}
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#ifndef TRACE_H
+#define TRACE_H
+
+/*  Binary trace format (written by "sim convert", read through mmap)
+
+    offset 0                bp_trace_header (64 bytes)
+    offset pc_offset        num_branches PCs, pc_bytes (4 or 8) bytes each, host byte order
+    offset outcome_offset   ceil(num_branches / 64) uint64_t words, bit (i % 64) of word (i / 64)
+                            is set if branch i was taken
+
+    PCs are stored fixed-width so the reader can index them directly out of the mapping; 4 byte
+    PCs are used whenever every PC in the trace fits, which halves the file size for 32-bit traces.
+*/
+#define BP_TRACE_MAGIC      "BPTRACE"
+#define BP_TRACE_VERSION    1
+
+#define TRACE_BATCH_SIZE    4096    // branches per batch passed from the text parser thread to the simulator
+#define TRACE_RING_SLOTS    8       // batches in flight between the parser thread and the simulator
+
+typedef struct trace_batch{
+    uint64_t            addr[TRACE_BATCH_SIZE];
+    char                outcome[TRACE_BATCH_SIZE];
+    size_t              count;      // 0 marks the end of the trace
+}trace_batch;
+
+struct trace_stream;
+
+typedef struct bp_trace_header{
+    char     magic[8];          // BP_TRACE_MAGIC, NUL padded
+    uint32_t version;           // BP_TRACE_VERSION
+    uint32_t pc_bytes;          // width of each PC in the PC array (4 or 8)
+    uint64_t num_branches;      // number of branch records in the trace
+    uint64_t pc_offset;         // file offset of the PC array (pc_bytes aligned)
+    uint64_t outcome_offset;    // file offset of the outcome bitmap (8 byte aligned)
+    uint64_t reserved[3];
+}bp_trace_header;
+
+/*  Reads a trace in one of three ways:
+      - binary trace (file starts with the binary trace magic): straight out of a read-only memory mapping,
+        with no per-record parsing or copying
+      - text trace ("<hex pc> <t|n>" per line) from a file, or from stdin if trace_file is "-"
+      - gzip, zstd, xz or bzip2 compressed text trace, detected by its magic bytes and decompressed on the fly
+        by the matching command line tool, so the uncompressed trace is never written to disk
+    Text is parsed on a separate thread, which hands fixed-size batches of branches to the simulator through
+    a bounded lock-free ring buffer, so that I/O, decompression, parsing and prediction all overlap.
+*/
+class TraceReader{
+public:
+    TraceReader();
+    ~TraceReader();
+
+    // Returns false if the file cannot be opened. With hold_parser, the parser thread of a text trace starts
+    // but reads nothing until release_parser(), so it can be watched (see parser_thread_id) from the start.
+    bool open(const char* trace_file, bool hold_parser = false);
+    void release_parser();
+    void close();
+
+    bool is_binary() const { return map != NULL; }
+    uint64_t position() const { return pos; }   // number of branches consumed so far
+    uint64_t length() const { return num_branches; }    // number of branches in a binary trace
+    long parser_thread_id() const;     // thread id of the text parser thread; 0 for binary traces, or off Linux
+
+    // Feed up to count of the next branches to f(uint64_t addr, char outcome), where outcome is
+    // 't' or 'n' as in the text trace. Returns the number of branches fed; less than count means end of trace.
+    template<class F> uint64_t run(uint64_t count, F f);
+
+    // Skip the next count branches (without parsing them, for binary traces). Returns the number skipped.
+    uint64_t skip(uint64_t count);
+
+private:
+    bool next_batch();                      // move to the next text batch; false at the end of the trace
+
+    trace_stream*           stream;         // text trace parser thread and ring buffer
+    const trace_batch*      batch;          // text batch being consumed
+    size_t                  batch_pos;      // next branch in batch
+    const unsigned char*    map;            // binary trace mapping
+    size_t                  map_size;
+    const bp_trace_header*  header;
+    const uint64_t*         outcome_bits;
+    uint64_t                num_branches;
+    uint64_t                pos;
+
+    TraceReader(const TraceReader&);
+    TraceReader& operator=(const TraceReader&);
+};
+
+// Writes a binary trace. PCs are streamed straight to the file; the outcome bitmap (1 bit per branch) is
+// kept in memory and written, together with the final header, by close().
+class TraceWriter{
+public:
+    TraceWriter();
+    ~TraceWriter();
+
+    void open(const char* trace_file, uint32_t pc_bytes);  // pc_bytes is 4 or 8; exits on error
+    void write(uint64_t addr, bool taken);
+    uint64_t close();                                       // returns the number of branches written; exits on error
+
+private:
+    void flush();
+
+    FILE*                       FP;
+    const char*                 name;
+    uint32_t                    pc_bytes;
+    uint64_t                    num_branches;
+    std::vector<uint64_t>       outcome_bits;
+    std::vector<unsigned char>  block;
+    size_t                      block_used;
+
+    TraceWriter(const TraceWriter&);
+    TraceWriter& operator=(const TraceWriter&);
+};
+
+// Convert a text trace into the binary trace format. Returns the number of branches written.
+uint64_t convert_trace(const char* text_file, const char* binary_file);
+
+template<class F>
+uint64_t TraceReader::run(uint64_t count, F f){
+    uint64_t done = 0;
+
+    if(map == NULL){
+        // Text trace: consume the batches produced by the parser thread
+        while(done < count){
+            if(batch == NULL || batch_pos == batch->count){
+                if(!next_batch()){
+                    break;
+                }
+            }
+            size_t n = batch->count - batch_pos;
+            if(n > count - done){
+                n = count - done;
+            }
+            for(size_t i = batch_pos; i < batch_pos + n; i++){
+                f(batch->addr[i], batch->outcome[i]);
+            }
+            batch_pos += n;
+            done += n;
+        }
+        pos += done;
+        return done;
+    }
+
+    // Binary trace: walk the mapped PC array and outcome bitmap in place
+    uint64_t end = pos + count;
+    if(end > num_branches || end < pos){
+        end = num_branches;
+    }
+    if(header->pc_bytes == 4){
+        const uint32_t* pc = (const uint32_t*)(map + header->pc_offset);
+        for(uint64_t i = pos; i < end; i++){
+            f((uint64_t)pc[i], ((outcome_bits[i >> 6] >> (i & 63)) & 1) ? 't' : 'n');
+        }
+    } else {
+        const uint64_t* pc = (const uint64_t*)(map + header->pc_offset);
+        for(uint64_t i = pos; i < end; i++){
+            f((uint64_t)pc[i], ((outcome_bits[i >> 6] >> (i & 63)) & 1) ? 't' : 'n');
+        }
+    }
+    done = end - pos;
+    pos = end;
+    return done;
+}
+
+inline uint64_t TraceReader::skip(uint64_t count){
+    if(map == NULL){
+        return run(count, [](uint64_t, char){});
+    }
+    uint64_t skipped = (count < num_branches - pos) ? count : num_branches - pos;
+    pos += skipped;
+    return skipped;
+}
+
+#endif